@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+
+// Width of a machine word in bits on the default machine
+const int WORD_BITS = 8;
+
+// Rotates and shifts work on words of Bits bits held in any unsigned type
+// The intermediate value is 64 bits wide, so shifting a 32-bit word by its full width is defined
+
+// Rotate left by any amount, carry is the last bit rotated out (the new lowest bit)
+template <int Bits = WORD_BITS, class Word>
+inline Word rotateLeft(Word value, int amount, bool &carry)
+{
+    amount %= Bits;
+    if (amount == 0)
+        return value;
+
+    uint64_t wide = value;
+    Word result = (Word)((wide << amount) | (wide >> (Bits - amount)));
+    carry = result & 1;
+    return result;
+}
+
+// Rotate right by any amount, carry is the last bit rotated out (the new highest bit)
+template <int Bits = WORD_BITS, class Word>
+inline Word rotateRight(Word value, int amount, bool &carry)
+{
+    amount %= Bits;
+    if (amount == 0)
+        return value;
+
+    uint64_t wide = value;
+    Word result = (Word)((wide >> amount) | (wide << (Bits - amount)));
+    carry = (result >> (Bits - 1)) & 1;
+    return result;
+}
+
+// Shift left filling with zeros, carry is the last bit shifted out
+template <int Bits = WORD_BITS, class Word>
+inline Word shiftLeft(Word value, int amount, bool &carry)
+{
+    if (amount == 0)
+        return value;
+    if (amount > Bits)
+        return 0;
+
+    uint64_t wide = value;
+    carry = (wide >> (Bits - amount)) & 1;
+    return (Word)(wide << amount);
+}
+
+// Shift right filling with zeros, carry is the last bit shifted out
+template <int Bits = WORD_BITS, class Word>
+inline Word shiftRight(Word value, int amount, bool &carry)
+{
+    if (amount == 0)
+        return value;
+    if (amount > Bits)
+        return 0;
+
+    uint64_t wide = value;
+    carry = (wide >> (amount - 1)) & 1;
+    return (Word)(wide >> amount);
+}
@@ -0,0 +1,378 @@
+#pragma once
+#include "function.h"
+#include <charconv>
+#include <algorithm>
+#include <unordered_map>
+
+// Most words a source line can hold: label, mnemonic and up to three operands
+const int MAX_TOKENS = 5;
+
+// Table entry mapping a mnemonic to its opcode
+struct Mnemonic
+{
+    const char *name;
+    Opcode opcode;
+    int operands;
+};
+
+const Mnemonic MNEMONICS[] = {
+    {"MOV", OP_MOV, 2},
+    {"ADD", OP_ADD, 2},
+    {"SUB", OP_SUB, 2},
+    {"MUL", OP_MUL, 2},
+    {"DIV", OP_DIV, 2},
+    {"INC", OP_INC, 1},
+    {"DEC", OP_DEC, 1},
+    {"ROL", OP_ROL, 2},
+    {"ROR", OP_ROR, 2},
+    {"SHL", OP_SHL, 2},
+    {"SHR", OP_SHR, 2},
+    {"IN", OP_IN, 1},
+    {"OUT", OP_OUT, 1},
+    {"STORE", OP_STORE, 2},
+    {"LOAD", OP_LOAD, 2},
+    {"AND", OP_AND, 2},
+    {"OR", OP_OR, 2},
+    {"XOR", OP_XOR, 2},
+    {"NOT", OP_NOT, 1},
+    {"CMP", OP_CMP, 2},
+    {"JMP", OP_JMP, 1},
+    {"JZ", OP_JZ, 1},
+    {"JNZ", OP_JNZ, 1},
+    {"JC", OP_JC, 1},
+    {"MEMSET", OP_MEMSET, 3},
+    {"MEMCPY", OP_MEMCPY, 3},
+    {"MEMCMP", OP_MEMCMP, 3},
+    {"VADD", OP_VADD, 3},
+    {"VXOR", OP_VXOR, 3},
+    {"VSUM", OP_VSUM, 3}};
+
+// Names of superinstructions, which cannot be written in source
+const Mnemonic FUSED_MNEMONICS[] = {
+    {"INC*N", OP_INCN, 1},
+    {"DEC*N", OP_DECN, 1},
+    {"LD+ADD+ST", OP_ADDM, 2}};
+
+// Function to get the mnemonic of an opcode
+const char *opcodeName(Opcode opcode)
+{
+    for (const Mnemonic &entry : MNEMONICS)
+        if (entry.opcode == opcode)
+            return entry.name;
+    for (const Mnemonic &entry : FUSED_MNEMONICS)
+        if (entry.opcode == opcode)
+            return entry.name;
+    return "?";
+}
+
+// Jump whose label is resolved once the whole file has been read
+struct LabelReference
+{
+    size_t instruction;
+    string_view label;
+    int lineNumber;
+};
+
+// Function to split a line into tokens that view into the source text
+// Spaces separate tokens, commas do too unless they are inside quotes
+int tokenizeLine(string_view line, string_view tokens[])
+{
+    int count = 0;
+    size_t start = 0;
+    bool insideToken = false;
+    bool insideQuotes = false;
+
+    for (size_t i = 0; i <= line.size(); i++)
+    {
+        char letter = i < line.size() ? line[i] : ' ';
+
+        if (letter == '"')
+            insideQuotes = !insideQuotes;
+
+        bool separator = letter == ' ' || letter == '\t' || letter == '\r' || (letter == ',' && !insideQuotes);
+
+        if (!separator && !insideToken)
+        {
+            // A new word starts here
+            start = i;
+            insideToken = true;
+        }
+        else if (separator && insideToken)
+        {
+            // Found a separator, consider the current word as complete
+            if (count < MAX_TOKENS)
+                tokens[count] = line.substr(start, i - start);
+            count++;
+            insideToken = false;
+        }
+    }
+
+    return count;
+}
+
+// Function to parse a whole token as a decimal number
+bool parseNumber(string_view token, int32_t &value)
+{
+    const char *first = token.data();
+    const char *last = token.data() + token.size();
+
+    // from_chars does not accept the leading plus sign stoi allowed
+    if (first != last && *first == '+')
+        first++;
+
+    auto result = from_chars(first, last, value);
+    return result.ec == errc() && result.ptr == last;
+}
+
+// Function to get the index of a register from its name
+int getRegisterIndex(string_view registerName, int registerCount)
+{
+    // Register names are R followed by a single register number the machine has
+    if (registerName.size() == 2 && registerName[0] == 'R' &&
+        registerName[1] >= '0' && registerName[1] < '0' + registerCount)
+        return registerName[1] - '0';
+    return -1; // Return -1 if the register name is not found
+}
+
+// Function to decode a register or constant operand
+bool decodeValue(string_view operand, AddressMode &mode, int32_t &value, int registerCount)
+{
+    // Check if the operand is a register
+    if (operand[0] == 'R')
+    {
+        mode = MODE_REGISTER;
+        value = getRegisterIndex(operand, registerCount);
+        return value != -1;
+    }
+
+    mode = MODE_IMMEDIATE;
+    return parseNumber(operand, value);
+}
+
+// Function to decode a memory operand, either a direct address or [Rn]
+bool decodeAddress(string_view operand, AddressMode &mode, int32_t &value, int registerCount)
+{
+    // Check if the operand is a memory address specified by a register
+    if (operand.size() > 2 && operand.substr(0, 2) == "[R" && operand.back() == ']')
+    {
+        mode = MODE_INDIRECT;
+        value = getRegisterIndex(operand.substr(1, operand.size() - 2), registerCount);
+        return value != -1;
+    }
+
+    mode = MODE_DIRECT;
+    return parseNumber(operand, value);
+}
+
+// Function to decode a register operand, -1 marks an invalid register
+bool decodeRegister(string_view operand, AddressMode &mode, int32_t &value, int registerCount)
+{
+    mode = MODE_REGISTER;
+    value = getRegisterIndex(operand, registerCount);
+    return true;
+}
+
+// Function to decode the register holding the cell count of a block instruction
+bool decodeCount(string_view operand, uint8_t &aux, int registerCount)
+{
+    int index = getRegisterIndex(operand, registerCount);
+    aux = (uint8_t)index;
+    return index != -1;
+}
+
+// Function to decode the tokens of one line into a fixed-size instruction
+bool decodeInstruction(const Mnemonic &mnemonic, const string_view command[], Instruction &instruction, int registerCount)
+{
+    instruction = Instruction{mnemonic.opcode, MODE_NONE, MODE_NONE, 0, 0, 0};
+
+    switch (mnemonic.opcode)
+    {
+    case OP_MOV:
+        // MOV accepts a register, [Rn] or a constant as its source
+        if (command[1][0] == '[')
+            return decodeAddress(command[1], instruction.srcMode, instruction.src, registerCount) &&
+                   decodeRegister(command[2], instruction.dstMode, instruction.dst, registerCount);
+        return decodeValue(command[1], instruction.srcMode, instruction.src, registerCount) &&
+               decodeRegister(command[2], instruction.dstMode, instruction.dst, registerCount);
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_CMP:
+        return decodeValue(command[1], instruction.srcMode, instruction.src, registerCount) &&
+               decodeRegister(command[2], instruction.dstMode, instruction.dst, registerCount);
+    case OP_INC:
+    case OP_DEC:
+    case OP_IN:
+    case OP_NOT:
+        return decodeRegister(command[1], instruction.dstMode, instruction.dst, registerCount);
+    case OP_ROL:
+    case OP_ROR:
+    case OP_SHL:
+    case OP_SHR:
+        // Negative amounts have no meaning for rotates and shifts
+        instruction.srcMode = MODE_IMMEDIATE;
+        return decodeRegister(command[1], instruction.dstMode, instruction.dst, registerCount) &&
+               parseNumber(command[2], instruction.src) && instruction.src >= 0;
+    case OP_OUT:
+        return decodeValue(command[1], instruction.srcMode, instruction.src, registerCount);
+    case OP_STORE:
+        return decodeRegister(command[1], instruction.srcMode, instruction.src, registerCount) &&
+               decodeAddress(command[2], instruction.dstMode, instruction.dst, registerCount);
+    case OP_LOAD:
+        return decodeRegister(command[1], instruction.dstMode, instruction.dst, registerCount) &&
+               decodeAddress(command[2], instruction.srcMode, instruction.src, registerCount);
+    case OP_JMP:
+    case OP_JZ:
+    case OP_JNZ:
+    case OP_JC:
+        // The label is turned into an instruction index after the last line
+        instruction.dstMode = MODE_TARGET;
+        return true;
+    case OP_MEMSET:
+        // MEMSET value, address, Rcount
+        return decodeValue(command[1], instruction.srcMode, instruction.src, registerCount) &&
+               decodeAddress(command[2], instruction.dstMode, instruction.dst, registerCount) &&
+               decodeCount(command[3], instruction.aux, registerCount);
+    case OP_MEMCPY:
+    case OP_MEMCMP:
+    case OP_VADD:
+    case OP_VXOR:
+        // Source range, destination range and the register holding the number of cells
+        return decodeAddress(command[1], instruction.srcMode, instruction.src, registerCount) &&
+               decodeAddress(command[2], instruction.dstMode, instruction.dst, registerCount) &&
+               decodeCount(command[3], instruction.aux, registerCount);
+    case OP_VSUM:
+        return decodeAddress(command[1], instruction.srcMode, instruction.src, registerCount) &&
+               decodeRegister(command[2], instruction.dstMode, instruction.dst, registerCount) &&
+               decodeCount(command[3], instruction.aux, registerCount);
+    default:
+        break;
+    }
+
+    return false;
+}
+
+// Function to assemble source text into a decoded program in a single pass
+// Register names are checked against the register count of the machine the program is for
+Program assemble(string_view text, int registerCount = REGISTER_SIZE)
+{
+    Program program;
+    string_view tokens[MAX_TOKENS];
+    int lineNumber = 0;
+    unordered_map<string_view, int32_t> labels;
+    vector<LabelReference> references;
+
+    // One instruction per line at most, so the arrays never reallocate
+    size_t lineCount = count(text.begin(), text.end(), '\n') + 1;
+    program.code.reserve(lineCount);
+    program.source.reserve(lineCount);
+    program.lines.reserve(lineCount);
+
+    // Process each line of the source text
+    while (!text.empty())
+    {
+        size_t end = text.find('\n');
+        string_view line = text.substr(0, end);
+        text = end == string_view::npos ? string_view() : text.substr(end + 1);
+        lineNumber++;
+
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+
+        // Split the line into individual words without copying them
+        int tokenCount = tokenizeLine(line, tokens);
+        string_view *command = tokens;
+
+        // Blank lines are reported but lose no instruction, so they are not counted
+        if (tokenCount == 0)
+        {
+            cerr << "Error: Invalid command on line " << lineNumber << endl;
+            continue;
+        }
+
+        // A leading "name:" labels the next instruction
+        if (command[0].size() > 1 && command[0].back() == ':')
+        {
+            string_view label = command[0].substr(0, command[0].size() - 1);
+            if (!labels.emplace(label, (int32_t)program.code.size()).second)
+            {
+                program.errors++;
+                cerr << "Error: Duplicate label " << label << " on line " << lineNumber << endl;
+            }
+
+            command++;
+            if (--tokenCount == 0)
+                continue;
+        }
+
+        // Look up the mnemonic once instead of on every execution
+        const Mnemonic *mnemonic = nullptr;
+        for (const Mnemonic &entry : MNEMONICS)
+            if (command[0] == entry.name)
+                mnemonic = &entry;
+
+        if (mnemonic == nullptr)
+        {
+            program.errors++;
+            cerr << "Error: Invalid command on line " << lineNumber << endl;
+            continue;
+        }
+
+        if (tokenCount <= mnemonic->operands)
+        {
+            program.errors++;
+            cerr << "Error: Missing operand on line " << lineNumber << endl;
+            continue;
+        }
+
+        Instruction instruction;
+        if (!decodeInstruction(*mnemonic, command, instruction, registerCount))
+        {
+            program.errors++;
+            cerr << "Error: Invalid operand on line " << lineNumber << endl;
+            continue;
+        }
+
+        if (instruction.dstMode == MODE_TARGET)
+            references.push_back({program.code.size(), command[1], lineNumber});
+
+        program.code.push_back(instruction);
+        program.source.push_back(line);
+        program.lines.push_back(lineNumber);
+    }
+
+    // Resolve every jump to an instruction index so taken jumps need no lookup
+    for (const LabelReference &reference : references)
+    {
+        auto target = labels.find(reference.label);
+        if (target != labels.end())
+            program.code[reference.instruction].dst = target->second;
+        else
+        {
+            // The jump keeps an impossible target, so the verifier refuses to run the program
+            program.errors++;
+            cerr << "Error: Undefined label " << reference.label << " on line " << reference.lineNumber << endl;
+            program.code[reference.instruction].dst = -1;
+        }
+    }
+
+    return program;
+}
+
+// Function to map a source file and assemble it, false if it cannot be opened
+bool assembleFile(const string &path, Program &program, int registerCount = REGISTER_SIZE)
+{
+    shared_ptr<MappedFile> file = make_shared<MappedFile>();
+    if (!file->open(path))
+        return false;
+
+    program = assemble(file->text(), registerCount);
+
+    // The program's source views point into the mapping, keep it alive
+    program.sourceFile = file;
+    return true;
+}
@@ -0,0 +1,398 @@
+#pragma once
+#include "assembler.h"
+#include "threaded.h"
+#include "objectfile.h"
+#include "optimizer.h"
+#include "lanes.h"
+#include "verifier.h"
+#include "snapshot.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+#include <set>
+
+// Thread pool where every worker owns a task deque and steals from the others when idle
+class ThreadPool
+{
+private:
+    // Per-worker queue of pending tasks
+    struct Worker
+    {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+
+    mutex stateLock;
+    condition_variable wakeUp;
+    condition_variable idle;
+    size_t queued = 0;  // Tasks waiting in any deque
+    size_t pending = 0; // Tasks submitted but not finished
+    size_t nextWorker = 0;
+    bool stopping = false;
+
+    // Function to take a task from the worker's own deque or steal one from another worker
+    bool popTask(size_t self, function<void()> &task);
+
+    // Main loop of every worker thread
+    void workerLoop(size_t self);
+
+public:
+    explicit ThreadPool(size_t threadCount);
+    ~ThreadPool();
+
+    // Method to queue a task on the next worker in round-robin order
+    void submit(function<void()> task);
+
+    // Method to block until every submitted task has finished
+    void wait();
+};
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+    if (threadCount == 0)
+        threadCount = 1;
+
+    for (size_t i = 0; i < threadCount; i++)
+        workers.push_back(make_unique<Worker>());
+    for (size_t i = 0; i < threadCount; i++)
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(stateLock);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+
+    for (thread &worker : threads)
+        worker.join();
+}
+
+bool ThreadPool::popTask(size_t self, function<void()> &task)
+{
+    // Newest task from the own deque keeps the worker's data warm
+    {
+        Worker &own = *workers[self];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty())
+        {
+            task = move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Oldest task from another worker's deque is stolen
+    for (size_t offset = 1; offset < workers.size(); offset++)
+    {
+        Worker &victim = *workers[(self + offset) % workers.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty())
+        {
+            task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t self)
+{
+    while (true)
+    {
+        function<void()> task;
+
+        if (popTask(self, task))
+        {
+            {
+                lock_guard<mutex> guard(stateLock);
+                queued--;
+            }
+
+            task();
+
+            lock_guard<mutex> guard(stateLock);
+            if (--pending == 0)
+                idle.notify_all();
+            continue;
+        }
+
+        // Sleep until new work is queued or the pool shuts down
+        unique_lock<mutex> guard(stateLock);
+        wakeUp.wait(guard, [this]
+                    { return stopping || queued > 0; });
+        if (stopping && queued == 0)
+            return;
+    }
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    size_t target;
+    {
+        lock_guard<mutex> guard(stateLock);
+        target = nextWorker++ % workers.size();
+        pending++;
+    }
+
+    {
+        Worker &worker = *workers[target];
+        lock_guard<mutex> guard(worker.lock);
+        worker.tasks.push_back(move(task));
+    }
+
+    {
+        lock_guard<mutex> guard(stateLock);
+        queued++;
+    }
+    wakeUp.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    unique_lock<mutex> guard(stateLock);
+    idle.wait(guard, [this]
+              { return pending == 0; });
+}
+
+// Settings shared by every program of a batch
+struct RunOptions
+{
+    Engine engine = ENGINE_SWITCH;
+    MachineModel machine = MACHINE_8; // Word width, registers and memory of every run
+    string cacheDirectory; // Object cache, empty to always assemble
+    bool optimize = false; // Run the peephole optimizer before execution
+    vector<int> input;     // Values for IN, every run reads them from the start
+    bool lanes = false;    // Run input batches in lockstep lane groups instead of one machine per run
+    int quantum = 1000;    // Instructions a server session runs before the next session gets its turn
+    shared_ptr<const Snapshot> snapshot; // State every run starts in, null for a fresh machine
+};
+
+// Function to create the machine a run starts on, forked from the snapshot of the options when there is one
+template <class Config>
+unique_ptr<BasicMachine<Config>> startMachine(const RunOptions &options)
+{
+    if (options.snapshot)
+        return options.snapshot->fork<Config>();
+
+    // Large machines do not fit on a worker's stack
+    return make_unique<BasicMachine<Config>>();
+}
+
+// Function to compile a program once for every run the options make of it, null when the runs interpret it
+shared_ptr<const JitProgram> prepareNative(const Program &program, const RunOptions &options)
+{
+    if (options.engine != ENGINE_JIT || options.machine != MACHINE_8 || options.snapshot)
+        return nullptr;
+    return compileJit(program);
+}
+
+// Function to run a program on its own machine with buffered input and output, returning its result text
+// Native is the code prepareNative compiled for the program, null to interpret it
+template <class Config>
+string runWithBuffers(const Program &program, const vector<int> &values, const RunOptions &options, const JitProgram *native)
+{
+    auto machine = startMachine<Config>(options);
+    InputBuffer input(values);
+    OutputBuffer output;
+    machine->input = &input;
+    machine->output = &output;
+
+    runWithEngine(options.engine, *machine, program, native);
+    mapProgramCounter(*machine, program);
+
+    // Captured output comes first, in the order an interactive run shows it
+    ostringstream result;
+    output.print(result);
+    printState(result, *machine);
+    return result.str();
+}
+
+// Function to run a program on the machine model of the options
+string runWithBuffers(const Program &program, const vector<int> &values, const RunOptions &options, const JitProgram *native)
+{
+    return withMachineConfig(options.machine, [&](auto config)
+                             { return runWithBuffers<decltype(config)>(program, values, options, native); });
+}
+
+// Function to assemble and run one program file and write its final state
+bool runProgramFile(const filesystem::path &inputPath, const filesystem::path &outputPath, const RunOptions &options)
+{
+    Program program;
+    if (!loadProgram(inputPath, program, options.cacheDirectory, registerCount(options.machine)))
+    {
+        cerr << "Error: Unable to open input file " << inputPath << endl;
+        return false;
+    }
+    if (!verifyProgram(program, options.machine))
+    {
+        cerr << "Error: Program " << inputPath << " rejected by the verifier." << endl;
+        return false;
+    }
+
+    if (options.optimize)
+        program = optimizeProgram(program);
+
+    // Every program gets its own machine, so files never share state
+    shared_ptr<const JitProgram> native = prepareNative(program, options);
+    string result = runWithBuffers(program, options.input, options, native.get());
+
+    ofstream output(outputPath);
+    if (!output.is_open())
+    {
+        cerr << "Error: Unable to open output file " << outputPath << endl;
+        return false;
+    }
+    output << result;
+    return true;
+}
+
+// Program found for a batch, with the place of its result under an output directory
+struct BatchProgram
+{
+    filesystem::path source;
+    filesystem::path relative; // Path below the scanned directory, or the file name of a listed file
+};
+
+// Function to expand files and directories into the list of .asm programs to run, false if a directory cannot be read
+bool collectPrograms(const vector<string> &paths, vector<BatchProgram> &programs)
+{
+    for (const string &path : paths)
+    {
+        error_code error;
+        if (filesystem::is_directory(path, error))
+        {
+            vector<BatchProgram> found;
+            filesystem::recursive_directory_iterator entry(path, error), end;
+            for (; !error && entry != end; entry.increment(error))
+                if (entry->is_regular_file(error) && entry->path().extension() == ".asm")
+                    found.push_back({entry->path(), entry->path().lexically_relative(path)});
+            if (error)
+            {
+                cerr << "Error: Unable to read directory " << path << endl;
+                return false;
+            }
+
+            // Directory order is unspecified, keep batches reproducible
+            sort(found.begin(), found.end(), [](const BatchProgram &a, const BatchProgram &b)
+                 { return a.source < b.source; });
+            programs.insert(programs.end(), found.begin(), found.end());
+        }
+        else
+            programs.push_back({path, filesystem::path(path).filename()});
+    }
+    return true;
+}
+
+// Function to run many programs in parallel, one result file per program
+// Under an output directory results keep their path below the scanned directory, so same-named programs never share one
+int runBatch(const vector<string> &paths, const string &outputDirectory, size_t threadCount, const RunOptions &options)
+{
+    vector<BatchProgram> programs;
+    if (!collectPrograms(paths, programs))
+        return 1;
+    atomic<int> failures(0);
+
+    {
+        ThreadPool pool(threadCount);
+        set<filesystem::path> results;
+
+        for (const BatchProgram &program : programs)
+        {
+            // Results go next to the source unless an output directory is given
+            filesystem::path result = outputDirectory.empty() ? program.source : filesystem::path(outputDirectory) / program.relative;
+            result.replace_extension(".out");
+
+            // Two listed programs can still map to one result, the later one fails instead of overwriting it
+            if (!results.insert(result.lexically_normal()).second)
+            {
+                cerr << "Error: Program " << program.source << " would overwrite the result file " << result << endl;
+                failures++;
+                continue;
+            }
+
+            error_code error;
+            if (!outputDirectory.empty() && !filesystem::create_directories(result.parent_path(), error) && error)
+            {
+                cerr << "Error: Unable to create output directory " << result.parent_path() << endl;
+                failures++;
+                continue;
+            }
+
+            filesystem::path source = program.source;
+            pool.submit([source, result, &options, &failures]
+                        {
+                            if (!runProgramFile(source, result, options))
+                                failures++;
+                        });
+        }
+
+        pool.wait();
+    }
+
+    cerr << "Batch: " << programs.size() << " programs, " << failures << " failed" << endl;
+    return failures == 0 ? 0 : 1;
+}
+
+// Function to run one program over many input vectors in parallel, results are written in input order
+int runInputBatch(const Program &program, const vector<vector<int>> &inputs, const string &outputPath, size_t threadCount, const RunOptions &options)
+{
+    vector<string> results(inputs.size());
+
+    // Lanes exist for fresh default machines only, other runs use one machine per input
+    bool lanes = options.lanes && options.machine == MACHINE_8 && !options.snapshot && lanesSupported(program);
+    if (options.lanes && !lanes)
+        cerr << "Lanes: program, machine or snapshot not supported, running one machine per input" << endl;
+
+    // Every input runs the same code, so it is compiled once for all of them
+    shared_ptr<const JitProgram> native = lanes ? nullptr : prepareNative(program, options);
+
+    {
+        ThreadPool pool(threadCount);
+
+        // Runs are grouped so short programs are not dominated by queueing, lane chunks hold whole groups
+        size_t chunk = max<size_t>(1, inputs.size() / (max<size_t>(threadCount, 1) * 8));
+        if (lanes)
+            chunk = (chunk + LANES - 1) / LANES * LANES;
+
+        for (size_t first = 0; first < inputs.size(); first += chunk)
+        {
+            size_t last = min(first + chunk, inputs.size());
+            pool.submit([&program, &inputs, &results, &options, &native, lanes, first, last]
+                        {
+                            if (lanes)
+                                runLaneBatch(program, inputs, first, last, results);
+                            else
+                                for (size_t i = first; i < last; i++)
+                                    results[i] = runWithBuffers(program, inputs[i], options, native.get());
+                        });
+        }
+
+        pool.wait();
+    }
+
+    ofstream output(outputPath);
+    if (!output.is_open())
+    {
+        cerr << "Error: Unable to open output file " << outputPath << endl;
+        return 1;
+    }
+    for (size_t i = 0; i < results.size(); i++)
+        output << "Run " << i + 1 << ":\n" << results[i];
+
+    cerr << "Input batch: " << inputs.size() << " runs" << endl;
+    return 0;
+}
@@ -0,0 +1,174 @@
+// Instruction-throughput benchmarks for the interpreter core
+// Build: g++ -std=c++17 -O2 -pthread benchmark.cpp -o benchmark
+#include "assembler.h"
+#include "threaded.h"
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Every heap allocation made while a workload runs is counted here
+atomic<size_t> allocationCount(0);
+
+// GCC cannot see that the replaced new and delete below belong together
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(size_t size)
+{
+    allocationCount++;
+    if (void *block = malloc(size ? size : 1))
+        return block;
+    throw bad_alloc();
+}
+
+void operator delete(void *block) noexcept
+{
+    free(block);
+}
+
+void operator delete(void *block, size_t) noexcept
+{
+    free(block);
+}
+
+// Straight-line instruction count of every generated workload
+const int WORKLOAD_LENGTH = 10000;
+
+// Minimum measured time per workload, in seconds
+const double MIN_SECONDS = 0.5;
+
+// Synthetic program exercising one family of opcodes
+struct Workload
+{
+    string name;
+    string source;
+};
+
+// Function to repeat a block of lines until the program has the given length
+string repeatLines(const vector<string> &block, int length)
+{
+    string source;
+    for (int i = 0; i < length; i++)
+        source += block[i % block.size()] + "\n";
+    return source;
+}
+
+// Function to build the list of workloads, one per opcode family plus mixed programs
+vector<Workload> buildWorkloads()
+{
+    vector<Workload> workloads;
+
+    workloads.push_back({"mov", repeatLines({"MOV 17, R0", "MOV R0, R1", "MOV 3, R2", "MOV [R2], R3"}, WORKLOAD_LENGTH)});
+    workloads.push_back({"arithmetic", repeatLines({"MOV 7, R0", "ADD 5, R0", "SUB 2, R0", "MUL 3, R0", "DIV 2, R0", "ADD R0, R1"}, WORKLOAD_LENGTH)});
+    workloads.push_back({"inc_dec", repeatLines({"INC R0", "INC R1", "DEC R2", "INC R3"}, WORKLOAD_LENGTH)});
+    workloads.push_back({"rotate_shift", repeatLines({"MOV 150, R0", "ROL R0, 3", "ROR R0, 1", "SHL R0, 2", "SHR R0, 1"}, WORKLOAD_LENGTH)});
+    workloads.push_back({"store_load", repeatLines({"MOV 9, R1", "STORE R0, 5", "LOAD R2, 5", "STORE R2, [R1]", "LOAD R3, [R1]"}, WORKLOAD_LENGTH)});
+    workloads.push_back({"block", repeatLines({"MOV 32, R1", "MEMSET 7, 0, R1", "MEMCPY 0, 32, R1", "VADD 0, 32, R1",
+                                               "VXOR 32, 0, R1", "VSUM 0, R2, R1", "MEMCMP 0, 32, R1"},
+                                              WORKLOAD_LENGTH)});
+
+    // Checksum over memory with a counted loop, the shape of real guest programs
+    workloads.push_back({"mixed_checksum", repeatLines({"MOV 0, R0", "MOV 63, R1",
+                                                        "fill: STORE R1, [R1]", "DEC R1", "JNZ fill",
+                                                        "MOV 63, R1", "sum: MOV [R1], R2", "XOR R2, R0", "ROL R0, 1",
+                                                        "DEC R1", "JNZ sum"},
+                                                       11)});
+
+    // Straight-line generated code mixing every family
+    workloads.push_back({"mixed_generated", repeatLines({"MOV 10, R0", "ADD R0, R1", "INC R2", "SUB 3, R1", "STORE R1, 5",
+                                                         "LOAD R3, 5", "ROL R1, 3", "MOV [R2], R4", "AND 15, R4", "CMP R4, R3"},
+                                                        WORKLOAD_LENGTH)});
+    return workloads;
+}
+
+// Function to print one result as a JSON object on its own line
+void report(const string &workload, const string &engine, const string &unit, size_t operations, double seconds, size_t allocations)
+{
+    cout << "{\"workload\":\"" << workload << "\""
+         << ",\"engine\":\"" << engine << "\""
+         << ",\"" << unit << "s\":" << operations
+         << ",\"seconds\":" << seconds
+         << ",\"" << unit << "s_per_second\":" << operations / seconds
+         << ",\"ns_per_" << unit << "\":" << seconds * 1e9 / operations
+         << ",\"allocations_per_" << unit << "\":" << (double)allocations / operations
+         << "}" << endl;
+}
+
+// Function to run a decoded program repeatedly until enough time has passed
+void benchmarkExecution(const Workload &workload, Engine engine, const string &engineName)
+{
+    Program program = assemble(workload.source);
+    Machine machine;
+    size_t instructions = 0;
+
+    // Native code is compiled once up front, like a hot program would be
+    JitProgram compiled;
+    bool native = engine == ENGINE_JIT && compiled.compile(program);
+
+    auto start = chrono::steady_clock::now();
+    size_t allocationsBefore = allocationCount;
+    double seconds = 0;
+
+    while (seconds < MIN_SECONDS)
+    {
+        // Restart the same machine so state stays realistic between runs
+        machine.pc = 0;
+        machine.counter = 0;
+        if (native)
+            compiled.run(machine);
+        else
+            runWithEngine(engine, machine, program);
+        instructions += machine.counter;
+
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    report(workload.name, engineName, "instruction", instructions, seconds, allocationCount - allocationsBefore);
+}
+
+// Function to assemble a source repeatedly to measure front-end throughput
+void benchmarkAssembly(const Workload &workload)
+{
+    size_t lines = 0;
+    size_t lineCount = count(workload.source.begin(), workload.source.end(), '\n');
+
+    auto start = chrono::steady_clock::now();
+    size_t allocationsBefore = allocationCount;
+    double seconds = 0;
+
+    while (seconds < MIN_SECONDS)
+    {
+        Program program = assemble(workload.source);
+        lines += lineCount;
+
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    report("assemble_" + workload.name, "none", "line", lines, seconds, allocationCount - allocationsBefore);
+}
+
+int main(int argc, char *argv[])
+{
+    // An optional argument selects the workloads whose name contains it
+    string filter = argc > 1 ? argv[1] : "";
+
+    for (const Workload &workload : buildWorkloads())
+    {
+        if (workload.name.find(filter) == string::npos)
+            continue;
+
+        benchmarkExecution(workload, ENGINE_SWITCH, "switch");
+        benchmarkExecution(workload, ENGINE_THREADED, "threaded");
+        benchmarkExecution(workload, ENGINE_JIT, "jit");
+    }
+
+    for (const Workload &workload : buildWorkloads())
+    {
+        if (("assemble_" + workload.name).find(filter) == string::npos)
+            continue;
+
+        benchmarkAssembly(workload);
+    }
+
+    return 0;
+}
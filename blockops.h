@@ -0,0 +1,149 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Host kernels of the block instructions, over ranges of words of any unsigned type
+// Every kernel handles whole host vectors first and the cells that are left one by one
+
+#if defined(__GNUC__)
+#define BLOCK_SIMD 1
+
+// Bytes of one host vector, SSE2 and NEON registers are 16 bytes wide
+const int BLOCK_VECTOR_BYTES = 16;
+
+// Host vector of Count elements, GCC lowers the wider ones to several registers
+template <class Element, int Count>
+struct BlockVector
+{
+    typedef Element type __attribute__((vector_size(sizeof(Element) * Count)));
+};
+#endif
+
+// Function to find the first cell where two ranges differ, count when they are equal
+template <class Word>
+size_t blockMismatch(const Word *a, const Word *b, size_t count)
+{
+    // memcmp of the host library is vectorized, it only has to tell equal chunks apart
+    const size_t chunk = 64 / sizeof(Word);
+    size_t i = 0;
+    while (i + chunk <= count && memcmp(a + i, b + i, chunk * sizeof(Word)) == 0)
+        i += chunk;
+    while (i < count && a[i] == b[i])
+        i++;
+    return i;
+}
+
+// Function to add source words to destination words, sums above the largest word become 0 like updateFlags does
+// Sets overflow when any sum did not fit and zero when every result is 0
+// The source is read in increasing order, so it may overlap the destination only at a higher address
+template <class Word>
+void blockAdd(Word *destination, const Word *source, size_t count, bool &overflow, bool &zero)
+{
+    size_t i = 0;
+    Word any = 0;
+    bool carry = false;
+
+#if defined(BLOCK_SIMD)
+    const int width = BLOCK_VECTOR_BYTES / sizeof(Word);
+    typedef typename BlockVector<Word, width>::type Vector;
+    Vector anyVector = {};
+    Vector carryVector = {};
+    for (; i + width <= count; i += width)
+    {
+        Vector a, b;
+        memcpy(&a, destination + i, sizeof(a));
+        memcpy(&b, source + i, sizeof(b));
+
+        // An unsigned sum wrapped exactly when it is below an operand
+        Vector sum = a + b;
+        Vector wrapped = (Vector)(sum < a);
+        sum &= ~wrapped;
+        memcpy(destination + i, &sum, sizeof(sum));
+
+        anyVector |= sum;
+        carryVector |= wrapped;
+    }
+    for (int lane = 0; lane < width; lane++)
+    {
+        any |= anyVector[lane];
+        carry |= carryVector[lane] != 0;
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        Word sum = (Word)(destination[i] + source[i]);
+        bool wrapped = sum < destination[i];
+        destination[i] = wrapped ? 0 : sum;
+        any |= destination[i];
+        carry |= wrapped;
+    }
+
+    overflow = carry;
+    zero = any == 0;
+}
+
+// Function to xor source words into destination words, zero is set when every result is 0
+// The source is read in increasing order, so it may overlap the destination only at a higher address
+template <class Word>
+void blockXor(Word *destination, const Word *source, size_t count, bool &zero)
+{
+    size_t i = 0;
+    Word any = 0;
+
+#if defined(BLOCK_SIMD)
+    const int width = BLOCK_VECTOR_BYTES / sizeof(Word);
+    typedef typename BlockVector<Word, width>::type Vector;
+    Vector anyVector = {};
+    for (; i + width <= count; i += width)
+    {
+        Vector a, b;
+        memcpy(&a, destination + i, sizeof(a));
+        memcpy(&b, source + i, sizeof(b));
+        a ^= b;
+        memcpy(destination + i, &a, sizeof(a));
+        anyVector |= a;
+    }
+    for (int lane = 0; lane < width; lane++)
+        any |= anyVector[lane];
+#endif
+
+    for (; i < count; i++)
+    {
+        destination[i] ^= source[i];
+        any |= destination[i];
+    }
+
+    zero = any == 0;
+}
+
+// Function to add up a range of words without losing any carry
+// Partial sums of 8 and 16-bit words fit 32 bits for every memory size a machine has, 32-bit words need 64
+template <class Word>
+uint64_t blockSum(const Word *cells, size_t count)
+{
+    using Sum = std::conditional_t<sizeof(Word) < 4, uint32_t, uint64_t>;
+    size_t i = 0;
+    uint64_t total = 0;
+
+#if defined(BLOCK_SIMD)
+    const int width = BLOCK_VECTOR_BYTES / sizeof(Word);
+    typedef typename BlockVector<Word, width>::type Vector;
+    typedef typename BlockVector<Sum, width>::type SumVector;
+    SumVector sums = {};
+    for (; i + width <= count; i += width)
+    {
+        Vector value;
+        memcpy(&value, cells + i, sizeof(value));
+        sums += __builtin_convertvector(value, SumVector);
+    }
+    for (int lane = 0; lane < width; lane++)
+        total += sums[lane];
+#endif
+
+    for (; i < count; i++)
+        total += cells[i];
+    return total;
+}
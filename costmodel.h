@@ -0,0 +1,237 @@
+#pragma once
+#include "assembler.h"
+#include <algorithm>
+#include <iomanip>
+
+// Cost model used when no file is given, in the format cost model files use
+// Every line is a mnemonic, an optional addressing mode and the cycles it takes, the mode applies when an operand has it
+// Memory modes win over the others, so "LOAD indirect 3" is the cost of LOAD [Rn], R1
+const char DEFAULT_COST_MODEL[] =
+    "MUL 4\n"
+    "DIV 16\n"
+    "MOV indirect 3\n"
+    "LOAD direct 2\n"
+    "LOAD indirect 3\n"
+    "STORE direct 2\n"
+    "STORE indirect 3\n"
+    "IN 4\n"
+    "OUT 4\n"
+    "MEMSET 2\n"
+    "MEMCPY 2\n"
+    "MEMCMP 2\n"
+    "VADD 2\n"
+    "VXOR 2\n"
+    "VSUM 2\n"
+    "CELL 1\n";
+
+// Names of the addressing modes in a cost model, indexed by AddressMode
+const char *const COST_MODES[] = {"", "register", "immediate", "direct", "indirect"};
+const int COST_MODE_COUNT = 5;
+
+// Cycles every instruction costs on the guest, by opcode and addressing mode
+class CostModel
+{
+private:
+    // Cycles by opcode and by the mode of the instruction, -1 where the opcode's own cost (mode 0) applies
+    int32_t cycles[OPCODE_COUNT][COST_MODE_COUNT];
+    uint32_t cellCycles = 0; // Extra cycles per cell of a block instruction
+
+    // Method to get the cost of a source opcode in one mode
+    uint64_t lookup(Opcode opcode, AddressMode mode) const;
+
+public:
+    // Method to set every instruction to one cycle and then apply the default model
+    CostModel();
+
+    // Method to apply cost lines on top of the current costs, name is used in error messages
+    bool parse(string_view text, const string &name);
+
+    // Method to apply a cost model file on top of the current costs
+    bool load(const string &path);
+
+    // Method to get the fixed cycles of one source instruction
+    uint64_t cost(const Instruction &instruction) const;
+
+    uint32_t cellCost() const { return cellCycles; }
+};
+
+// Function to find the addressing mode that decides the cost of an instruction, memory operands first
+inline AddressMode costMode(AddressMode src, AddressMode dst)
+{
+    for (AddressMode mode : {MODE_INDIRECT, MODE_DIRECT, MODE_IMMEDIATE, MODE_REGISTER})
+        if (src == mode || dst == mode)
+            return mode;
+    return MODE_NONE;
+}
+
+CostModel::CostModel()
+{
+    for (int opcode = 0; opcode < OPCODE_COUNT; opcode++)
+    {
+        cycles[opcode][MODE_NONE] = 1;
+        for (int mode = MODE_REGISTER; mode < COST_MODE_COUNT; mode++)
+            cycles[opcode][mode] = -1;
+    }
+    parse(DEFAULT_COST_MODEL, "default");
+}
+
+bool CostModel::parse(string_view text, const string &name)
+{
+    int lineNumber = 0;
+    while (!text.empty())
+    {
+        size_t end = text.find('\n');
+        string_view line = text.substr(0, end);
+        text = end == string_view::npos ? string_view() : text.substr(end + 1);
+        lineNumber++;
+
+        // Everything after # is a comment
+        line = line.substr(0, line.find('#'));
+        string_view tokens[MAX_TOKENS];
+        int count = tokenizeLine(line, tokens);
+        if (count == 0)
+            continue;
+
+        int32_t value = 0;
+        int mode = MODE_NONE;
+        bool valid = (count == 2 || count == 3) && parseNumber(tokens[count - 1], value) && value >= 0;
+        if (valid && count == 3)
+        {
+            mode = find(COST_MODES + 1, COST_MODES + COST_MODE_COUNT, tokens[1]) - COST_MODES;
+            valid = mode < COST_MODE_COUNT;
+        }
+
+        const Mnemonic *mnemonic = nullptr;
+        for (const Mnemonic &entry : MNEMONICS)
+            if (tokens[0] == entry.name)
+                mnemonic = &entry;
+
+        if (valid && tokens[0] == "CELL" && count == 2)
+            cellCycles = value;
+        else if (valid && mnemonic)
+            cycles[mnemonic->opcode][mode] = value;
+        else
+        {
+            cerr << "Error: Invalid cost on line " << lineNumber << " of cost model " << name << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CostModel::load(const string &path)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        cerr << "Error: Unable to open cost model file " << path << endl;
+        return false;
+    }
+    return parse(file.text(), path);
+}
+
+uint64_t CostModel::lookup(Opcode opcode, AddressMode mode) const
+{
+    int32_t value = mode < COST_MODE_COUNT ? cycles[opcode][mode] : -1;
+    return value >= 0 ? value : cycles[opcode][MODE_NONE];
+}
+
+uint64_t CostModel::cost(const Instruction &instruction) const
+{
+    return lookup(instruction.opcode, costMode(instruction.srcMode, instruction.dstMode));
+}
+
+// Guest cycles and per-opcode counters of one run under a cost model
+// Costs are fixed per decoded instruction, so the same program and input always take the same cycles
+// An optimized instruction is charged as the source instructions it replaced, so --optimize never changes the report
+class CycleCounter
+{
+private:
+    // Fixed cycles of one source instruction, under its own opcode
+    struct Charge
+    {
+        Opcode opcode;
+        uint64_t cycles;
+    };
+
+    const Program &program;
+    vector<Charge> charges; // Source instructions of every decoded instruction, in program order
+    vector<uint32_t> first; // Index of the first charge of each decoded instruction, and of the end
+    uint32_t cellCycles;
+
+    uint64_t cycles = 0;
+    uint64_t opcodeCounts[OPCODE_COUNT] = {};
+    uint64_t opcodeCycles[OPCODE_COUNT] = {};
+
+public:
+    // The source is the program before optimizing, the same program when it was not optimized
+    CycleCounter(const Program &program, const Program &source, const CostModel &model);
+
+    // Method to charge the instruction at the program counter, called before it executes
+    template <class Config>
+    void charge(const BasicMachine<Config> &machine)
+    {
+        const Instruction &instruction = program.code[machine.pc];
+        for (uint32_t i = first[machine.pc]; i < first[machine.pc + 1]; i++)
+        {
+            cycles += charges[i].cycles;
+            opcodeCounts[charges[i].opcode]++;
+            opcodeCycles[charges[i].opcode] += charges[i].cycles;
+        }
+
+        // Block instructions also pay per cell, counted before the count register can change
+        // The optimizer never replaces them, so the cells go to their own opcode
+        if (instruction.opcode >= OP_MEMSET)
+        {
+            uint64_t cells = (uint64_t)cellCycles * blockCount(machine, instruction);
+            cycles += cells;
+            opcodeCycles[instruction.opcode] += cells;
+        }
+    }
+
+    // Method to write the total and the per-opcode counters
+    void writeReport(ostream &output) const;
+};
+
+CycleCounter::CycleCounter(const Program &program, const Program &source, const CostModel &model)
+    : program(program), cellCycles(model.cellCost())
+{
+    // The instructions between two original indices are the ones the optimizer merged into one
+    for (size_t i = 0; i < program.code.size(); i++)
+    {
+        size_t begin = program.originalIndex.empty() ? i : program.originalIndex[i];
+        size_t end = program.originalIndex.empty() ? i + 1 : program.originalIndex[i + 1];
+        first.push_back((uint32_t)charges.size());
+        for (size_t j = begin; j < end; j++)
+            charges.push_back({source.code[j].opcode, model.cost(source.code[j])});
+    }
+    first.push_back((uint32_t)charges.size());
+}
+
+void CycleCounter::writeReport(ostream &output) const
+{
+    uint64_t instructions = 0;
+    for (int opcode = 0; opcode < OPCODE_COUNT; opcode++)
+        instructions += opcodeCounts[opcode];
+
+    output << "Cycles   : " << cycles << " cycles, " << instructions << " instructions" << endl;
+
+    // Opcodes, most cycles first
+    vector<int> opcodes;
+    for (int opcode = 0; opcode < OPCODE_COUNT; opcode++)
+        if (opcodeCounts[opcode] > 0)
+            opcodes.push_back(opcode);
+    stable_sort(opcodes.begin(), opcodes.end(), [this](int a, int b)
+                { return opcodeCycles[a] > opcodeCycles[b]; });
+
+    output << endl
+           << "Opcodes:" << endl;
+    output << setfill(' ') << setw(10) << "opcode" << setw(14) << "count" << setw(14) << "cycles" << setw(8) << "%" << endl;
+    for (int opcode : opcodes)
+    {
+        output << setw(10) << opcodeName((Opcode)opcode)
+               << setw(14) << opcodeCounts[opcode]
+               << setw(14) << opcodeCycles[opcode]
+               << setw(8) << fixed << setprecision(1) << (cycles ? 100.0 * opcodeCycles[opcode] / cycles : 0) << endl;
+    }
+}
@@ -0,0 +1,210 @@
+#pragma once
+#include "profiler.h"
+#include <iomanip>
+
+// Which line of a full set a cache level replaces
+enum ReplacementPolicy
+{
+    REPLACE_LRU,   // The line used longest ago
+    REPLACE_FIFO,  // The line filled longest ago
+    REPLACE_RANDOM // Any line, from a fixed seed so runs repeat
+};
+
+// Shape of one cache level, sizes are in memory cells
+struct CacheLevelConfig
+{
+    uint32_t size = 0;
+    uint32_t ways = 1;
+    uint32_t line = 1;
+    ReplacementPolicy policy = REPLACE_LRU;
+};
+
+// Function to parse a cache level as SIZE,WAYS,LINE[,lru|fifo|random], false if the shape is impossible
+bool parseCacheLevel(const string &text, CacheLevelConfig &config)
+{
+    string_view tokens[MAX_TOKENS];
+    int count = tokenizeLine(text, tokens);
+    int32_t size, ways, line;
+    if ((count != 3 && count != 4) || !parseNumber(tokens[0], size) || !parseNumber(tokens[1], ways) || !parseNumber(tokens[2], line))
+        return false;
+    if (size <= 0 || ways <= 0 || line <= 0 || size % (ways * line) != 0)
+        return false;
+
+    config = {(uint32_t)size, (uint32_t)ways, (uint32_t)line, REPLACE_LRU};
+    if (count == 4)
+    {
+        if (tokens[3] == "fifo")
+            config.policy = REPLACE_FIFO;
+        else if (tokens[3] == "random")
+            config.policy = REPLACE_RANDOM;
+        else if (tokens[3] != "lru")
+            return false;
+    }
+    return true;
+}
+
+// One set-associative level of the simulated data cache
+class CacheLevel
+{
+private:
+    CacheLevelConfig config;
+    uint32_t sets;
+    vector<int64_t> tags;    // Line held by each way of each set, -1 when empty
+    vector<uint64_t> stamps; // Last use for LRU, fill time for FIFO
+    uint64_t clock = 0;
+    uint64_t seed = 88172645463325252ULL;
+
+public:
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    vector<uint64_t> missHeat; // Misses by the address that caused them
+
+    CacheLevel(const CacheLevelConfig &config, int memorySize);
+
+    // Method to look up the line of an address and fill it on a miss, true on a hit
+    bool access(uint32_t address);
+
+    uint32_t lineSize() const { return config.line; }
+
+    // Method to write the shape and the counters of the level
+    void writeSummary(ostream &output, const char *name) const;
+};
+
+CacheLevel::CacheLevel(const CacheLevelConfig &config, int memorySize)
+    : config(config),
+      sets(config.size / (config.ways * config.line)),
+      tags(config.size / config.line, -1),
+      stamps(config.size / config.line, 0),
+      missHeat(memorySize, 0)
+{
+}
+
+bool CacheLevel::access(uint32_t address)
+{
+    int64_t line = address / config.line;
+    size_t first = (line % sets) * config.ways;
+    clock++;
+
+    size_t victim = first;
+    for (size_t way = first; way < first + config.ways; way++)
+    {
+        if (tags[way] == line)
+        {
+            hits++;
+            if (config.policy == REPLACE_LRU)
+                stamps[way] = clock;
+            return true;
+        }
+        if (tags[victim] != -1 && (tags[way] == -1 || stamps[way] < stamps[victim]))
+            victim = way;
+    }
+
+    // Empty ways are filled first, a full set loses the line its policy picks
+    if (tags[victim] != -1)
+    {
+        if (config.policy == REPLACE_RANDOM)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            victim = first + seed % config.ways;
+        }
+        evictions++;
+    }
+
+    misses++;
+    missHeat[address]++;
+    tags[victim] = line;
+    stamps[victim] = clock;
+    return false;
+}
+
+void CacheLevel::writeSummary(ostream &output, const char *name) const
+{
+    static const char *const policies[] = {"lru", "fifo", "random"};
+    uint64_t accesses = hits + misses;
+    output << name << "       : " << config.size << " cells, " << config.ways << " ways, "
+           << config.line << " cells per line, " << policies[config.policy] << endl;
+    output << "  accesses " << accesses << ", hits " << hits << ", misses " << misses
+           << " (" << fixed << setprecision(1) << (accesses ? 100.0 * misses / accesses : 0) << "%), evictions " << evictions << endl;
+}
+
+// Data cache of one or two levels in front of guest memory, fed by the stepping interpreter
+// Runs without it never call into it, so the plain engines pay nothing for its existence
+class CacheSimulator
+{
+private:
+    vector<CacheLevel> levels; // L1 first, a level is only asked when the one before it missed
+
+    // Method to access one cell through the levels
+    void access(uint32_t address);
+
+    // Method to access every L1 line of a range of cells once, a block instruction streams through its lines
+    void access(const MemoryRange &range);
+
+public:
+    CacheSimulator(const vector<CacheLevelConfig> &configs, int memorySize);
+
+    // Method to simulate the memory the instruction at the program counter touches, called before it executes
+    template <class Config>
+    void record(const Program &program, const BasicMachine<Config> &machine)
+    {
+        MemoryAccess cells = memoryAccess(program.code[machine.pc], machine);
+        for (const MemoryRange &read : cells.reads)
+            if (read.count > 0)
+                access(read);
+        if (cells.write.count > 0)
+            access(cells.write);
+    }
+
+    // Method to write the counters of every level and the miss heat maps
+    void writeReport(ostream &output) const;
+};
+
+CacheSimulator::CacheSimulator(const vector<CacheLevelConfig> &configs, int memorySize)
+{
+    for (const CacheLevelConfig &config : configs)
+        levels.emplace_back(config, memorySize);
+}
+
+void CacheSimulator::access(uint32_t address)
+{
+    for (CacheLevel &level : levels)
+        if (level.access(address))
+            return;
+}
+
+void CacheSimulator::access(const MemoryRange &range)
+{
+    uint32_t line = levels[0].lineSize();
+    uint32_t end = range.address + range.count;
+    for (uint32_t address = range.address; address < end; address = (address / line + 1) * line)
+        access(address);
+}
+
+void CacheSimulator::writeReport(ostream &output) const
+{
+    for (size_t i = 0; i < levels.size(); i++)
+        levels[i].writeSummary(output, i == 0 ? "L1" : "L2");
+
+    // Rows of 8 cells like the memory dump, rows without a miss are left out
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        const vector<uint64_t> &heat = levels[i].missHeat;
+        output << endl
+               << (i == 0 ? "L1" : "L2") << " misses by address:" << endl;
+        for (size_t row = 0; row < heat.size(); row += 8)
+        {
+            size_t last = min(row + 8, heat.size());
+            if (all_of(heat.begin() + row, heat.begin() + last, [](uint64_t misses)
+                       { return misses == 0; }))
+                continue;
+
+            output << setfill(' ') << setw(8) << row << ":";
+            for (size_t address = row; address < last; address++)
+                output << setw(8) << heat[address];
+            output << endl;
+        }
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "function.h"
+#include <cstring>
+#include <limits>
+
+// How the interactive loop shows the machine after each instruction
+struct DisplayOptions
+{
+    bool diff = false;     // Print only what changed since the previous step
+    int redrawEvery = 64;  // Full tables every this many steps in diff mode, 0 for only on request
+    bool stepping = false; // Wait for a command before each instruction
+};
+
+// Per-step display of a machine, either the full tables or a one-line diff against what is on screen
+template <class Config>
+class StateDisplay
+{
+private:
+    DisplayOptions options;
+    unique_ptr<BasicMachine<Config>> shown; // State as it was last drawn
+    int sinceRedraw = 0;
+    bool redrawPending = true;
+
+    // Method to draw the full tables and remember what they show
+    void redraw(const BasicMachine<Config> &machine);
+
+    // Method to print the registers, flags and cells that differ from the last drawn state
+    void showChanges(const BasicMachine<Config> &machine);
+
+public:
+    explicit StateDisplay(const DisplayOptions &options);
+
+    // Method to show the state after an instruction
+    void show(const BasicMachine<Config> &machine);
+
+    // Method to wait for a step command, false when the user quits
+    bool pause(const BasicMachine<Config> &machine);
+
+    // Method to ask for the full tables on the next step
+    void requestRedraw() { redrawPending = true; }
+
+    bool stepping() const { return options.stepping; }
+};
+
+template <class Config>
+StateDisplay<Config>::StateDisplay(const DisplayOptions &options)
+    : options(options), shown(make_unique<BasicMachine<Config>>())
+{
+    if (options.stepping)
+        cout << "Stepping: Enter runs the next instruction, r redraws, c continues, q quits" << endl;
+}
+
+template <class Config>
+void StateDisplay<Config>::redraw(const BasicMachine<Config> &machine)
+{
+    displayRegisters(machine);
+    displayFlags(machine);
+    displayMemory(machine);
+
+    cout << endl;
+
+    *shown = machine;
+    sinceRedraw = 0;
+    redrawPending = false;
+}
+
+template <class Config>
+void StateDisplay<Config>::showChanges(const BasicMachine<Config> &machine)
+{
+    static const char *const flagNames[FLAGS_SIZE] = {"CF", "OF", "UF", "ZF"};
+
+    // The line is built first so the terminal gets a single write per step
+    string line = "      PC |" + to_string(machine.pc) + "|";
+
+    for (int i = 0; i < Config::REGISTERS; i++)
+        if (machine.registers[i] != shown->registers[i])
+            line += "  R" + to_string(i) + ": " + to_string((uint32_t)machine.registers[i]);
+
+    uint8_t flagChanges = machine.flags ^ shown->flags;
+    for (int i = 0; i < FLAGS_SIZE; i++)
+        if (flagChanges & (1 << i))
+            line += string("  ") + flagNames[i] + ": " + ((machine.flags & (1 << i)) ? "1" : "0");
+
+    // Most steps leave memory alone, one compare skips the scan for them
+    if (memcmp(machine.memory, shown->memory, sizeof(machine.memory)) != 0)
+        for (int i = 0; i < Config::MEMORY; i++)
+            if (machine.memory[i] != shown->memory[i])
+            {
+                line += "  [" + to_string(i) + "]: " + to_string((uint32_t)machine.memory[i]);
+                shown->memory[i] = machine.memory[i];
+            }
+
+    line += '\n';
+    cout << line;
+
+    memcpy(shown->registers, machine.registers, sizeof(machine.registers));
+    shown->flags = machine.flags;
+    shown->pc = machine.pc;
+}
+
+template <class Config>
+void StateDisplay<Config>::show(const BasicMachine<Config> &machine)
+{
+    // Without diff mode every step gets the full tables, as it always did
+    if (!options.diff || redrawPending || (options.redrawEvery > 0 && sinceRedraw >= options.redrawEvery))
+        redraw(machine);
+    else
+    {
+        showChanges(machine);
+        sinceRedraw++;
+    }
+}
+
+template <class Config>
+bool StateDisplay<Config>::pause(const BasicMachine<Config> &machine)
+{
+    while (options.stepping)
+    {
+        cout << "step> " << flush;
+
+        // Without a terminal to read from, the rest of the program just runs
+        string command;
+        if (!getline(cin, command))
+        {
+            options.stepping = false;
+            break;
+        }
+
+        if (command == "q")
+            return false;
+        if (command == "c")
+            options.stepping = false;
+        else if (command == "r")
+            redraw(machine);
+        else
+            break;
+    }
+    return true;
+}
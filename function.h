@@ -1,505 +1,810 @@
-w#include <iostream>
-#include <cmath>
+#pragma once
+#include <iostream>
 #include <vector>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <algorithm>
+#include "mappedfile.h"
+#include "alu.h"
+#include "blockops.h"
+#include "machineio.h"
 
 using namespace std;
 
-// Constants for memory, register, and flags sizes
+// Constants for memory, register, and flags sizes of the default machine
 const int MEMORY_SIZE = 64;
 const int REGISTER_SIZE = 7;
 const int FLAGS_SIZE = 4;
 
-// Initialize global variables
-int memory[MEMORY_SIZE];
-string registers[REGISTER_SIZE] = {"R0", "R1", "R2", "R3", "R4", "R5", "R6"};
-bool flags[FLAGS_SIZE];
-int counter = 1;
-ofstream output;
+// Register names are a single digit, so no machine has more than ten
+const int MAX_REGISTERS = 10;
+
+// Bits of the flags register (CF, OF, UF, ZF)
+const uint8_t FLAG_CF = 1 << 0;
+const uint8_t FLAG_OF = 1 << 1;
+const uint8_t FLAG_UF = 1 << 2;
+const uint8_t FLAG_ZF = 1 << 3;
+
+// Compile-time shape of a machine, every shape gets its own specialized interpreter
+template <int WordBits, int RegisterCount, int MemorySize>
+struct MachineConfig
+{
+    static_assert(WordBits == 8 || WordBits == 16 || WordBits == 32, "words are 8, 16 or 32 bits wide");
+    static_assert(RegisterCount >= 1 && RegisterCount <= MAX_REGISTERS, "registers are R0 to R9");
+    static_assert(MemorySize >= 8 && MemorySize % 8 == 0, "memory is shown in rows of 8 cells");
+
+    static constexpr int WORD_BITS = WordBits;
+    static constexpr int REGISTERS = RegisterCount;
+    static constexpr int MEMORY = MemorySize;
+
+    // Storage of one register or memory cell
+    using Word = conditional_t<WordBits == 8, uint8_t, conditional_t<WordBits == 16, uint16_t, uint32_t>>;
+
+    // Raw results before clamping, int is enough for 8-bit words and keeps that case as fast as before
+    using Wide = conditional_t<WordBits == 8, int, int64_t>;
+
+    // Largest word value, results above it overflow and it is the mask of wrap-around arithmetic
+    static constexpr Wide WORD_MAX = (Wide)(((int64_t)1 << WordBits) - 1);
+};
+
+// The original machine: 8-bit words, R0 to R6 and 64 bytes of memory
+using DefaultConfig = MachineConfig<WORD_BITS, REGISTER_SIZE, MEMORY_SIZE>;
+
+// Larger machines for data-processing programs
+using Config16 = MachineConfig<16, 8, 4096>;
+using Config32 = MachineConfig<32, 10, 65536>;
+
+// Machine shapes that can be chosen at runtime, each one an instantiation of the interpreter
+enum MachineModel
+{
+    MACHINE_8,  // DefaultConfig
+    MACHINE_16, // Config16
+    MACHINE_32  // Config32
+};
+
+// Function to call an action with the configuration of a machine model
+template <class Action>
+auto withMachineConfig(MachineModel model, Action &&action)
+{
+    if (model == MACHINE_16)
+        return action(Config16());
+    if (model == MACHINE_32)
+        return action(Config32());
+    return action(DefaultConfig());
+}
+
+// Function to get the number of registers of a machine model, the assembler checks names against it
+int registerCount(MachineModel model)
+{
+    return withMachineConfig(model, [](auto config)
+                             { return decltype(config)::REGISTERS; });
+}
+
+// Function to parse a machine model from the command line
+bool parseMachine(const string &name, MachineModel &model)
+{
+    if (name == "8")
+        model = MACHINE_8;
+    else if (name == "16")
+        model = MACHINE_16;
+    else if (name == "32")
+        model = MACHINE_32;
+    else
+        return false;
+    return true;
+}
+
+// Complete state of one interpreter instance
+template <class Config>
+struct BasicMachine
+{
+    typename Config::Word memory[Config::MEMORY] = {};
+    typename Config::Word registers[Config::REGISTERS] = {};
+    uint8_t flags = 0;
+    int pc = 0;      // Index of the next instruction to execute
+    int64_t counter = 0; // Number of instructions executed so far, 64 bits so long runs never overflow
+
+    // Where IN reads and OUT writes, the console prompt and cout when not set
+    InputBuffer *input = nullptr;
+    OutputBuffer *output = nullptr;
+};
+
+using Machine = BasicMachine<DefaultConfig>;
+
+// Function to turn the value of an address register into a memory address
+// Register-indirect addresses wrap around memory, with a mask when its size is a power of two
+template <class Config>
+inline uint32_t wrapAddress(uint64_t address)
+{
+    if constexpr ((Config::MEMORY & (Config::MEMORY - 1)) == 0)
+        return (uint32_t)(address & (Config::MEMORY - 1));
+    else
+        return (uint32_t)(address % Config::MEMORY);
+}
+
+// Opcodes understood by the interpreter
+enum Opcode : uint8_t
+{
+    OP_MOV,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_INC,
+    OP_DEC,
+    OP_ROL,
+    OP_ROR,
+    OP_SHL,
+    OP_SHR,
+    OP_IN,
+    OP_OUT,
+    OP_STORE,
+    OP_LOAD,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_NOT,
+    OP_CMP,
+    OP_JMP,
+    OP_JZ,
+    OP_JNZ,
+    OP_JC,
+
+    // Superinstructions only produced by the optimizer
+    OP_INCN, // INC repeated src times
+    OP_DECN, // DEC repeated src times
+    OP_ADDM, // LOAD aux, dst / ADD src, aux / STORE aux, dst
+
+    // Block instructions over ranges of cells, register aux holds the number of cells
+    OP_MEMSET, // Fill the cells at dst with the value src
+    OP_MEMCPY, // Copy the cells at src to dst
+    OP_MEMCMP, // Compare the cells at dst with the cells at src like CMP does, up to the first difference
+    OP_VADD,   // Add the cells at src to the cells at dst
+    OP_VXOR,   // Xor the cells at src into the cells at dst
+    OP_VSUM    // Add up the cells at src into register dst
+};
+
+// Number of opcodes, for tables indexed by opcode
+const int OPCODE_COUNT = OP_VSUM + 1;
+
+// Addressing modes of a decoded operand
+enum AddressMode : uint8_t
+{
+    MODE_NONE,      // Operand is not used
+    MODE_REGISTER,  // Register index
+    MODE_IMMEDIATE, // Constant value
+    MODE_DIRECT,    // Memory address
+    MODE_INDIRECT,  // Memory address held in a register ([Rn])
+    MODE_TARGET     // Instruction index a label was resolved to
+};
+
+// Fixed-size instruction decoded once by the assembler
+struct Instruction
+{
+    Opcode opcode;
+    AddressMode srcMode;
+    AddressMode dstMode;
+    uint8_t aux; // Extra register operand of superinstructions and block instructions
+    int32_t src;
+    int32_t dst;
+};
+
+// Decoded program produced by the assembler
+struct Program
+{
+    vector<Instruction> code;         // Flat array of decoded instructions
+    vector<string_view> source;       // Source text of each instruction, for display
+    vector<int> lines;                // Source line number of each instruction
+    shared_ptr<MappedFile> sourceFile; // Mapped source the text views point into
+    int errors = 0;                    // Lines the assembler rejected
+    vector<int32_t> originalIndex;     // Unoptimized index of each instruction and of the end, empty if not optimized
+};
+
+// Function to get the cell a memory operand starts at, register-indirect addresses wrap around memory
+template <class Config>
+inline uint32_t operandAddress(const BasicMachine<Config> &machine, AddressMode mode, int32_t operand)
+{
+    return mode == MODE_INDIRECT ? wrapAddress<Config>(machine.registers[operand]) : (uint32_t)operand;
+}
+
+// Function to get the number of cells a block instruction covers
+// The count comes from a register at run time, so ranges are cut where memory ends instead of being verified
+template <class Config>
+inline uint32_t blockCount(const BasicMachine<Config> &machine, const Instruction &instruction)
+{
+    uint32_t count = machine.registers[instruction.aux];
+    if (instruction.srcMode == MODE_DIRECT || instruction.srcMode == MODE_INDIRECT)
+        count = min<uint32_t>(count, Config::MEMORY - operandAddress(machine, instruction.srcMode, instruction.src));
+    if (instruction.dstMode == MODE_DIRECT || instruction.dstMode == MODE_INDIRECT)
+        count = min<uint32_t>(count, Config::MEMORY - operandAddress(machine, instruction.dstMode, instruction.dst));
+    return count;
+}
 
 // Class for MOV operations
-class Operations
+template <class Config>
+class BasicOperations
 {
 private:
-    // Function to get the index of a register by name
-    int getRegisterIndex(const string &registerName);
-
-    // Function to get the value of a register by name
-    int getRegisterValue(const string &registerName);
+    using Word = typename Config::Word;
+    using Wide = typename Config::Wide;
 
-    // Function to update the value of a register by index
-    void updateRegisterValue(int registerIndex, int newValue);
+    // Machine state the operations work on
+    BasicMachine<Config> &machine;
 
-    void updateFlags(int &value);
+    // Function to get the value of a register or a constant operand
+    Wide getOperandValue(AddressMode mode, int32_t operand);
 
-    // Helper method to convert decimal to binary
-    vector<int> decimalToBinary(int n);
+    // Function to update the value of a register by index
+    void updateRegisterValue(int registerIndex, Wide newValue);
 
-    // Helper method to convert binary to decimal
-    int binaryToDecimal(const vector<int> &binaryNum);
+    void updateFlags(Wide &value);
 
 public:
+    explicit BasicOperations(BasicMachine<Config> &machine) : machine(machine) {}
+
     // Method to perform MOV operation
-    void mov(const vector<string> &command);
+    void mov(const Instruction &instruction);
 
     // Methods for arithmetic operations
-    void performMathOperation(const vector<string> &command);
+    void performMathOperation(const Instruction &instruction);
 
     // Methods for incrementing and decrementing
-    void incrementAndDecrement(const vector<string> &command);
+    void incrementAndDecrement(const Instruction &instruction);
 
     // Methods for rotation and shift operations
-    void rotateAndShift(const vector<string> &command);
+    void rotateAndShift(const Instruction &instruction);
+
+    // Methods for bitwise AND, OR, XOR and NOT operations
+    void bitwiseOperation(const Instruction &instruction);
 
     // Methods for input and output operations
-    void input(const vector<string> &command);
+    void input(const Instruction &instruction);
 
-    void output(const vector<string> &command);
+    void output(const Instruction &instruction);
 
     // Methods for store and load operations
-    void store(const vector<string> &command);
+    void store(const Instruction &instruction);
+
+    void load(const Instruction &instruction);
+
+    // Methods for compare and jump operations
+    void compare(const Instruction &instruction);
+
+    void jump(const Instruction &instruction);
+
+    // Methods for superinstructions fused by the optimizer
+    void repeatIncrement(const Instruction &instruction);
 
-    void load(const vector<string> &command);
+    void addToMemory(const Instruction &instruction);
+
+    // Methods for block instructions, run by the host kernels of blockops.h
+    void blockMemory(const Instruction &instruction);
+
+    void vectorOperation(const Instruction &instruction);
 };
 
+using Operations = BasicOperations<DefaultConfig>;
+
 // Function to update flags based on a value
-void Operations::updateFlags(int &value)
+template <class Config>
+void BasicOperations<Config>::updateFlags(Wide &value)
 {
+    // Flags always describe the latest result, so they are not carried over
+    machine.flags = 0;
+
     // Check if the value exceeds the maximum limit
-    if (value > 255)
+    if (value > Config::WORD_MAX)
     {
         value = 0;
-        flags[0] = flags[1] = flags[3] = 1; // Set Carry Flag (CF), Overflow Flag (OF), and Zero Flag (ZF)
+        machine.flags |= FLAG_CF | FLAG_OF | FLAG_ZF; // Set Carry Flag (CF), Overflow Flag (OF), and Zero Flag (ZF)
     }
     // Check if the value is negative
     else if (value < 0)
     {
-        value = 255;
-        flags[2] = 1; // Set Underflow Flag (UF)
+        value = Config::WORD_MAX;
+        machine.flags |= FLAG_UF; // Set Underflow Flag (UF)
     }
     // Check if the value is zero
     else if (value == 0)
-        flags[3] = 1; // Set Zero Flag (ZF)
-}
-
-// Function to get the index of a register from its name
-int Operations::getRegisterIndex(const string &registerName)
-{
-    // Iterate through the registers to find the index corresponding to the given register name
-    for (int i = 0; i < REGISTER_SIZE; i++)
-        if (registerName == "R" + to_string(i))
-            return i;
-    return -1; // Return -1 if the register name is not found
+        machine.flags |= FLAG_ZF; // Set Zero Flag (ZF)
 }
 
 // Function to get the value of a register or a constant
-int Operations::getRegisterValue(const string &operand)
+template <class Config>
+typename Config::Wide BasicOperations<Config>::getOperandValue(AddressMode mode, int32_t operand)
 {
     // Check if the operand is a register
-    if (operand.substr(0, 1) == "R")
-    {
-        int registerIndex = stoi(operand.substr(1));
-        return stoi(registers[registerIndex]); // Return the value stored in the specified register
-    }
-    return stoi(operand); // Return the constant value if the operand is not a register
+    if (mode == MODE_REGISTER)
+        return machine.registers[operand]; // Return the value stored in the specified register
+    return operand; // Return the constant value if the operand is not a register
 }
 
 // Function to update the value of a register
-void Operations::updateRegisterValue(int registerIndex, int newValue)
+template <class Config>
+void BasicOperations<Config>::updateRegisterValue(int registerIndex, Wide newValue)
 {
-    registers[registerIndex] = to_string(newValue); // Update the value of the specified register
+    machine.registers[registerIndex] = (Word)newValue; // Update the value of the specified register
 }
 
 // Move operation implementation within the Operations class
-void Operations::mov(const vector<string> &command)
+template <class Config>
+void BasicOperations<Config>::mov(const Instruction &instruction)
 {
-    int destinationIndex = getRegisterIndex(command[2]);
-
-    // Check if the destination register is valid
-    if (destinationIndex != -1)
-    {
-        int sourceValue = 0;
-        int sourceIndex = getRegisterIndex(command[1]);
-
-        // Retrieve the source value based on the source operand
-        if (sourceIndex != -1)
-        {
-            sourceValue = stoi(registers[sourceIndex]); // Source is another register
-        }
-        else if (command[1][0] == '[')
-        {
-            int memoryLocation = stoi(registers[command[1][2] - '0']);
+    int destinationIndex = instruction.dst;
 
-            // Check if the memory location is within bounds
-            if (memoryLocation >= 0 && memoryLocation < MEMORY_SIZE)
-                sourceValue = memory[memoryLocation]; // Source is a memory address
-        }
-        else
-            sourceValue = stoi(command[1]); // Source is a constant value
+    Wide sourceValue = 0;
 
-        // Update flags and the destination register with the source value
-        updateFlags(sourceValue);
-        updateRegisterValue(destinationIndex, sourceValue);
+    // Retrieve the source value based on the source operand
+    if (instruction.srcMode == MODE_REGISTER)
+    {
+        sourceValue = machine.registers[instruction.src]; // Source is another register
     }
-    else
+    else if (instruction.srcMode == MODE_INDIRECT)
     {
-        // Invalid destination register
-        cerr << "Error: Invalid destination register." << endl;
+        sourceValue = machine.memory[wrapAddress<Config>(machine.registers[instruction.src])]; // Source is a memory address
     }
+    else
+        sourceValue = instruction.src; // Source is a constant value
+
+    // Update flags and the destination register with the source value
+    updateFlags(sourceValue);
+    updateRegisterValue(destinationIndex, sourceValue);
 }
 
 // Addition operation implementation within the Operations class
-void Operations::performMathOperation(const vector<string> &command)
+template <class Config>
+void BasicOperations<Config>::performMathOperation(const Instruction &instruction)
 {
-    int destinationIndex = getRegisterIndex(command[2]);
+    int destinationIndex = instruction.dst;
 
-    // Check if the destination register is valid
-    if (destinationIndex != -1)
-    {
-        int currentRegisterValue = stoi(registers[destinationIndex]); // Retrieve the current value of the destination register
-        int sourceValue = getRegisterValue(command[1]);               // Retrieve the value of the source operand
+    Wide currentRegisterValue = machine.registers[destinationIndex];                    // Retrieve the current value of the destination register
+    Wide sourceValue = getOperandValue(instruction.srcMode, instruction.src);  // Retrieve the value of the source operand
 
-        // Variable to store the result of the mathematical operation
-        int result;
+    // Variable to store the result of the mathematical operation
+    Wide result = currentRegisterValue;
 
-        // Perform the specified arithmetic operation based on the command
-        if (command[0] == "ADD")
-        {
-            result = currentRegisterValue + sourceValue;
-        }
-        else if (command[0] == "SUB")
-        {
-            result = currentRegisterValue - sourceValue;
-        }
-        else if (command[0] == "MUL")
-        {
-            result = currentRegisterValue * sourceValue;
-        }
-        else if (command[0] == "DIV")
+    // Perform the specified arithmetic operation based on the opcode
+    if (instruction.opcode == OP_ADD)
+    {
+        result = currentRegisterValue + sourceValue;
+    }
+    else if (instruction.opcode == OP_SUB)
+    {
+        result = currentRegisterValue - sourceValue;
+    }
+    else if (instruction.opcode == OP_MUL)
+    {
+        result = currentRegisterValue * sourceValue;
+    }
+    else if (instruction.opcode == OP_DIV)
+    {
+        if (sourceValue != 0)
         {
-            if (sourceValue != 0)
-            {
-                result = currentRegisterValue / sourceValue;
-            }
+            result = currentRegisterValue / sourceValue;
         }
+    }
 
-        // Update flags based on the result of the operation
-        updateFlags(result);
+    // Update flags based on the result of the operation
+    updateFlags(result);
 
-        // Update the destination register with the result of the operation
-        updateRegisterValue(destinationIndex, result);
-    }
-    else
-    {
-        // Invalid destination register
-        cerr << "Error: Invalid destination register." << endl;
-    }
+    // Update the destination register with the result of the operation
+    updateRegisterValue(destinationIndex, result);
 }
 
-void Operations::incrementAndDecrement(const vector<string> &command)
+template <class Config>
+void BasicOperations<Config>::incrementAndDecrement(const Instruction &instruction)
 {
-    // Get the index of the register specified in the command
-    int registerIndex = getRegisterIndex(command[1]);
+    // Get the index of the register specified in the instruction
+    int registerIndex = instruction.dst;
 
-    // Check if the specified register is valid
-    if (registerIndex != -1)
-    {
-        // Retrieve the current value of the register
-        int result = stoi(registers[registerIndex]);
+    // Retrieve the current value of the register
+    Wide result = machine.registers[registerIndex];
 
-        // Perform the increment or decrement based on the command
-        if (command[0] == "INC")
-            result++; // Increment the value
-        else if (command[0] == "DEC")
-            result--; // Decrement the value
+    // Perform the increment or decrement based on the opcode
+    if (instruction.opcode == OP_INC)
+        result++; // Increment the value
+    else if (instruction.opcode == OP_DEC)
+        result--; // Decrement the value
 
-        // Update flags based on the result of the operation
-        updateFlags(result);
+    // Update flags based on the result of the operation
+    updateFlags(result);
 
-        // Update the register with the result of the operation
-        updateRegisterValue(registerIndex, result);
-    }
+    // Update the register with the result of the operation
+    updateRegisterValue(registerIndex, result);
+}
+
+
+// Rotate operation implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::rotateAndShift(const Instruction &instruction)
+{
+    // Get the index of the register specified in the instruction
+    int registerIndex = instruction.dst;
+
+    Word registerValue = machine.registers[registerIndex];
+    int amount = instruction.src;
+    bool carry = false;
+    Wide result = registerValue;
+
+    // Rotates and shifts work on the whole word at once in the ALU
+    if (instruction.opcode == OP_ROL)
+        result = rotateLeft<Config::WORD_BITS>(registerValue, amount, carry);
+    else if (instruction.opcode == OP_ROR)
+        result = rotateRight<Config::WORD_BITS>(registerValue, amount, carry);
+    else if (instruction.opcode == OP_SHL)
+        result = shiftLeft<Config::WORD_BITS>(registerValue, amount, carry);
+    else if (instruction.opcode == OP_SHR)
+        result = shiftRight<Config::WORD_BITS>(registerValue, amount, carry);
+
+    // Update flags based on the result and the bit moved out of the word
+    updateFlags(result);
+    if (carry)
+        machine.flags |= FLAG_CF;
+
+    // Update the register with the result of the operation
+    updateRegisterValue(registerIndex, result);
+}
+
+// Bitwise operation implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::bitwiseOperation(const Instruction &instruction)
+{
+    int destinationIndex = instruction.dst;
+
+    Wide currentRegisterValue = machine.registers[destinationIndex];
+    Wide result = currentRegisterValue;
+
+    // Constants are cut to the word width so the result stays a valid word
+    if (instruction.opcode == OP_NOT)
+        result = ~currentRegisterValue & Config::WORD_MAX;
     else
     {
-        // Invalid register specified in the command
-        cerr << "Error: Invalid register specified." << endl;
+        Wide sourceValue = getOperandValue(instruction.srcMode, instruction.src) & Config::WORD_MAX;
+
+        if (instruction.opcode == OP_AND)
+            result = currentRegisterValue & sourceValue;
+        else if (instruction.opcode == OP_OR)
+            result = currentRegisterValue | sourceValue;
+        else if (instruction.opcode == OP_XOR)
+            result = currentRegisterValue ^ sourceValue;
     }
-}
 
+    // Update flags based on the result of the operation
+    updateFlags(result);
+
+    // Update the destination register with the result of the operation
+    updateRegisterValue(destinationIndex, result);
+}
 
-// Convert decimal number to binary representation
-vector<int> Operations::decimalToBinary(int decimalNumber)
+// Input operation implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::input(const Instruction &instruction)
 {
-    vector<int> binaryRepresentation(8, 0); // Initialize a vector to store the binary representation, assuming 8 bits
+    int destinationIndex = instruction.dst;
 
-    int i = 0;
+    int inputValue = 0;
 
-    // Extract binary digits by dividing the decimal number by 2
-    while (decimalNumber > 0 && i < 8)
+    // Unattended runs read from the loaded input, interactive ones prompt
+    if (machine.input)
     {
-        binaryRepresentation[i] = decimalNumber % 2; // Store the remainder (binary digit) in the vector
-        decimalNumber = decimalNumber / 2; // Divide the decimal number by 2 to move to the next bit
-        i++; // Move to the next position in the binary representation vector
+        if (!machine.input->read(inputValue))
+            cerr << "Error: No input left for IN, reading 0." << endl;
+    }
+    else
+    {
+        cout << "User input => ";
+        cin >> inputValue;
     }
 
-    return binaryRepresentation; // Return the vector containing the binary representation
+    // Update flags and the destination register with the user input
+    Wide value = inputValue;
+    updateFlags(value);
+    updateRegisterValue(destinationIndex, value);
 }
 
+// Output operation implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::output(const Instruction &instruction)
+{
+    Wide sourceValue = getOperandValue(instruction.srcMode, instruction.src);
+
+    // Captured output is printed after the run instead of flushing per value
+    if (machine.output)
+        machine.output->write(sourceValue);
+    else
+        cout << "Output screen: " << sourceValue << endl;
+}
 
-// Convert binary representation to decimal value
-int Operations::binaryToDecimal(const vector<int> &binaryRepresentation)
+// Store operation implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::store(const Instruction &instruction)
 {
-    int decimalValue = 0, i = 0;
+    int sourceRegisterIndex = instruction.src;
 
-    // Iterate through each bit in the binary representation
-    for (int bit : binaryRepresentation)
-    {
-        // Calculate the decimal value by multiplying each bit by 2 raised to the corresponding power
-        decimalValue += bit * pow(2, i);
-        ++i; // Move to the next power of 2
-    }
+    Wide sourceValue = machine.registers[sourceRegisterIndex];
+    uint32_t memoryAddress = instruction.dst; // Direct addresses were checked by the verifier
 
-    return decimalValue; // Return the final decimal value
+    // Check if the destination is a memory address specified by a register
+    if (instruction.dstMode == MODE_INDIRECT)
+        memoryAddress = wrapAddress<Config>(machine.registers[instruction.dst]);
+
+    machine.memory[memoryAddress] = (Word)sourceValue;
 }
 
-// Rotate operation implementation within the Operations class
-void Operations::rotateAndShift(const vector<string> &command)
+// Load operation implementation within the LoadAndStore class
+template <class Config>
+void BasicOperations<Config>::load(const Instruction &instruction)
 {
-    // Get the index of the register specified in the command
-    int registerIndex = getRegisterIndex(command[1]);
+    int destinationRegisterIndex = instruction.dst;
 
-    // Check if the specified register is valid
-    if (registerIndex != -1)
-    {
-        // Retrieve the current value of the register
-        int registerValue = getRegisterValue(command[1]);
-        vector<int> binaryRepresentation = decimalToBinary(registerValue);
+    uint32_t memoryAddress = instruction.src; // Direct addresses were checked by the verifier
 
-        int amount = stoi(command[2]);
-        int size = binaryRepresentation.size();
-        vector<int> resultBinary(size, 0);
+    // Check if the source is a memory address specified by a register
+    if (instruction.srcMode == MODE_INDIRECT)
+        memoryAddress = wrapAddress<Config>(machine.registers[instruction.src]);
 
-        if (command[0] == "ROL")
-        {
-            // Rotate Left (ROL): Circularly shift bits to the left
-            amount = amount % size; // Ensure that the shift amount is within the size of the binary representation
-            for (int j = 0; j < size; j++)
-            {
-                int newPosition = (j + amount) % size; // Calculate the new position after rotation
-                resultBinary[newPosition] = binaryRepresentation[j];
-            }
-        }
-        else if (command[0] == "ROR")
-        {
-            // Rotate Right (ROR): Circularly shift bits to the right
-            amount = amount % size; // Ensure that the shift amount is within the size of the binary representation
-            for (int j = 0; j < size; j++)
-            {
-                int newPosition = (j - amount + size) % size; // Calculate the new position after rotation
-                resultBinary[newPosition] = binaryRepresentation[j];
-            }
-        }
-        else if (command[0] == "SHL")
-        {
-            // Shift Left: Simply shift the bits to the left, filling with zeros
-            for (int j = 0; j < size - amount; j++)
-            {
-                resultBinary[j + amount] = binaryRepresentation[j];
-            }
-        }
-        else if (command[0] == "SHR")
-        {
-            // Shift Right: Simply shift the bits to the right, filling with zeros
-            for (int j = 0; j < size - amount; j++)
-            {
-                resultBinary[j] = binaryRepresentation[j + amount];
-            }
-        }
+    // Update the destination register with the value from memory
+    machine.registers[destinationRegisterIndex] = machine.memory[memoryAddress];
+}
 
-        int resultDecimalValue = binaryToDecimal(resultBinary);
+// Compare operation implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::compare(const Instruction &instruction)
+{
+    int destinationIndex = instruction.dst;
 
-        // Update flags based on the result of the operation
-        updateFlags(resultDecimalValue);
+    // Compare works like SUB but only keeps the flags
+    Wide difference = machine.registers[destinationIndex] - getOperandValue(instruction.srcMode, instruction.src);
 
-        // Update the register with the result of the operation
-        updateRegisterValue(registerIndex, resultDecimalValue);
-    }
-    else
-    {
-        // Invalid register specified in the command
-        cerr << "Error: Invalid register specified." << endl;
-    }
+    machine.flags = 0;
+    if (difference == 0)
+        machine.flags |= FLAG_ZF; // Set Zero Flag (ZF) when both values are equal
+    else if (difference < 0)
+        machine.flags |= FLAG_CF | FLAG_UF; // Set Carry Flag (CF) and Underflow Flag (UF) on a borrow
 }
 
-// Input operation implementation within the Operations class
-void Operations::input(const vector<string> &command)
+// Jump operation implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::jump(const Instruction &instruction)
 {
-    int destinationIndex = getRegisterIndex(command[1]);
+    bool taken = false;
+
+    // Check the condition of the jump against the current flags
+    if (instruction.opcode == OP_JMP)
+        taken = true;
+    else if (instruction.opcode == OP_JZ)
+        taken = machine.flags & FLAG_ZF;
+    else if (instruction.opcode == OP_JNZ)
+        taken = !(machine.flags & FLAG_ZF);
+    else if (instruction.opcode == OP_JC)
+        taken = machine.flags & FLAG_CF;
+
+    // The target was resolved to an instruction index by the assembler
+    if (taken)
+        machine.pc = instruction.dst;
+}
 
-    // Check if the destination register is valid
-    if (destinationIndex != -1)
+// Repeated increment implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::repeatIncrement(const Instruction &instruction)
+{
+    int registerIndex = instruction.dst;
+    Wide result;
+
+    // Every single INC or DEC wraps through zero, so a run of them is a wrap-around add
+    if (instruction.opcode == OP_INCN)
     {
-        int inputValue = 0;
-        cout << "User input => ";
-        cin >> inputValue;
+        result = (machine.registers[registerIndex] + instruction.src) & Config::WORD_MAX;
 
-        // Update flags and the destination register with the user input
-        updateFlags(inputValue);
-        updateRegisterValue(destinationIndex, inputValue);
+        // Only the last step decides the flags, it overflowed if the result wrapped to zero
+        machine.flags = result == 0 ? FLAG_CF | FLAG_OF | FLAG_ZF : 0;
     }
     else
     {
-        // Invalid destination register
-        cerr << "Error: Invalid destination register." << endl;
+        result = (machine.registers[registerIndex] - instruction.src) & Config::WORD_MAX;
+
+        // The last step underflowed if the result wrapped to the largest word
+        machine.flags = result == Config::WORD_MAX ? FLAG_UF : result == 0 ? FLAG_ZF : 0;
     }
-}
 
-// Output operation implementation within the Operations class
-void Operations::output(const vector<string> &command)
-{
-    int sourceValue = getRegisterValue(command[1]);
-    cout << "Output screen: " << sourceValue << endl;
+    updateRegisterValue(registerIndex, result);
 }
 
-// Store operation implementation within the Operations class
-void Operations::store(const vector<string> &command)
+// Load, add and store back implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::addToMemory(const Instruction &instruction)
 {
-    int sourceRegisterIndex = getRegisterIndex(command[1]);
+    int registerIndex = instruction.aux;
+    int memoryAddress = instruction.dst;
 
-    // Check if the source register is valid
-    if (sourceRegisterIndex != -1)
-    {
-        int sourceValue = stoi(registers[sourceRegisterIndex]);
+    // Same steps as the LOAD, ADD and STORE it replaces
+    machine.registers[registerIndex] = machine.memory[memoryAddress];
 
-        // Check if the destination is a memory address specified by a register
-        if (command[2].find("[R") == 0 && command[2].back() == ']')
-        {
-            int registerIndex = stoi(command[2].substr(2, command[2].size() - 3));
+    Wide result = machine.registers[registerIndex] + getOperandValue(instruction.srcMode, instruction.src);
+    updateFlags(result);
+    updateRegisterValue(registerIndex, result);
 
-            // Check if the register index is within bounds
-            if (registerIndex >= 0 && registerIndex < MEMORY_SIZE)
-                memory[stoi(registers[registerIndex])] = sourceValue;
-        }
-        // Check if the destination is a direct memory address
-        else
-        {
-            int directMemoryAddress = stoi(command[2]);
+    machine.memory[memoryAddress] = machine.registers[registerIndex];
+}
 
-            // Check if the direct memory address is within bounds
-            if (directMemoryAddress >= 0 && directMemoryAddress < MEMORY_SIZE)
-                memory[directMemoryAddress] = sourceValue;
-        }
+// Fill, copy and compare implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::blockMemory(const Instruction &instruction)
+{
+    uint32_t count = blockCount(machine, instruction);
+    Word *destination = machine.memory + operandAddress(machine, instruction.dstMode, instruction.dst);
+
+    if (instruction.opcode == OP_MEMSET)
+    {
+        // Like STORE, the value is cut to the word width and the flags stay as they are
+        fill_n(destination, count, (Word)getOperandValue(instruction.srcMode, instruction.src));
+        return;
     }
-    else
+
+    const Word *source = machine.memory + operandAddress(machine, instruction.srcMode, instruction.src);
+    if (instruction.opcode == OP_MEMCPY)
     {
-        // Invalid destination register
-        cerr << "Error: Invalid destination register." << endl;
+        // Overlapping ranges copy as if the source were read first
+        memmove(destination, source, count * sizeof(Word));
+        return;
     }
+
+    // The first differing cells decide the flags the way CMP decides them for registers
+    uint32_t index = blockMismatch(destination, source, count);
+    machine.flags = 0;
+    if (index == count)
+        machine.flags |= FLAG_ZF;
+    else if (destination[index] < source[index])
+        machine.flags |= FLAG_CF | FLAG_UF;
 }
 
-// Load operation implementation within the LoadAndStore class
-void Operations::load(const vector<string> &command)
+// Element-wise add, xor and sum implementation within the Operations class
+template <class Config>
+void BasicOperations<Config>::vectorOperation(const Instruction &instruction)
 {
-    int destinationRegisterIndex = getRegisterIndex(command[1]);
+    uint32_t count = blockCount(machine, instruction);
+    const Word *source = machine.memory + operandAddress(machine, instruction.srcMode, instruction.src);
 
-    // Check if the destination register is valid
-    if (destinationRegisterIndex != -1)
+    if (instruction.opcode == OP_VSUM)
     {
-        int memoryValue;
-
-        // Check if the source is a memory address specified by a register
-        if (command[2].find("[R") == 0 && command[2].back() == ']')
-        {
-            int registerIndex = stoi(command[2].substr(2, command[2].size() - 3));
-
-            // Check if the register index is within bounds
-            if (registerIndex >= 0 && registerIndex < MEMORY_SIZE)
-                memoryValue = memory[stoi(registers[registerIndex])];
-        }
-        // Check if the source is a direct memory address
-        else
-        {
-            int directMemoryAddress = stoi(command[2]);
+        // The total is clamped once, like the result of a single ADD
+        Wide total = (Wide)min<uint64_t>(blockSum(source, count), (uint64_t)Config::WORD_MAX + 1);
+        updateFlags(total);
+        updateRegisterValue(instruction.dst, total);
+        return;
+    }
 
-            // Check if the direct memory address is within bounds
-            if (directMemoryAddress >= 0 && directMemoryAddress < MEMORY_SIZE)
-                memoryValue = memory[directMemoryAddress];
-        }
+    Word *destination = machine.memory + operandAddress(machine, instruction.dstMode, instruction.dst);
 
-        // Update the destination register with the value from memory
-        registers[destinationRegisterIndex] = to_string(memoryValue);
+    // Every source cell is read before it is overwritten, a source below the destination is copied first
+    vector<Word> copy;
+    if (source < destination && source + count > destination)
+    {
+        copy.assign(source, source + count);
+        source = copy.data();
     }
+
+    // Each cell is clamped like updateFlags clamps a register, the flags describe the whole range
+    bool overflow = false, zero;
+    if (instruction.opcode == OP_VADD)
+        blockAdd(destination, source, count, overflow, zero);
     else
+        blockXor(destination, source, count, zero);
+
+    machine.flags = 0;
+    if (overflow)
+        machine.flags |= FLAG_CF | FLAG_OF;
+    if (zero)
+        machine.flags |= FLAG_ZF;
+}
+
+// Execute operation based on the opcode of a decoded instruction
+template <class Config>
+void execute(BasicOperations<Config> &commands, const Instruction &instruction)
+{
+    // Dispatch on the opcode resolved by the assembler
+    switch (instruction.opcode)
     {
-        // Invalid destination register
-        cerr << "Error: Invalid destination register." << endl;
+    case OP_MOV:
+        commands.mov(instruction);
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+        commands.performMathOperation(instruction);
+        break;
+    case OP_INC:
+    case OP_DEC:
+        commands.incrementAndDecrement(instruction);
+        break;
+    case OP_ROL:
+    case OP_ROR:
+    case OP_SHL:
+    case OP_SHR:
+        commands.rotateAndShift(instruction);
+        break;
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOT:
+        commands.bitwiseOperation(instruction);
+        break;
+    case OP_IN:
+        commands.input(instruction);
+        break;
+    case OP_OUT:
+        commands.output(instruction);
+        break;
+    case OP_STORE:
+        commands.store(instruction);
+        break;
+    case OP_LOAD:
+        commands.load(instruction);
+        break;
+    case OP_CMP:
+        commands.compare(instruction);
+        break;
+    case OP_JMP:
+    case OP_JZ:
+    case OP_JNZ:
+    case OP_JC:
+        commands.jump(instruction);
+        break;
+    case OP_INCN:
+    case OP_DECN:
+        commands.repeatIncrement(instruction);
+        break;
+    case OP_ADDM:
+        commands.addToMemory(instruction);
+        break;
+    case OP_MEMSET:
+    case OP_MEMCPY:
+    case OP_MEMCMP:
+        commands.blockMemory(instruction);
+        break;
+    case OP_VADD:
+    case OP_VXOR:
+    case OP_VSUM:
+        commands.vectorOperation(instruction);
+        break;
     }
 }
-// Execute operation based on the command type
-void execute(vector<string> &command)
-{
-    Operations commands;
-
-    // Check the command type and execute the corresponding operation
-    if (command[0] == "MOV")
-        commands.mov(command);
-    else if (command[0] == "ADD" || command[0] == "SUB" || command[0] == "DIV" || command[0] == "MUL")
-        commands.performMathOperation(command);
-    else if (command[0] == "INC" || command[0] == "DEC")
-        commands.incrementAndDecrement(command);
-    else if (command[0] == "ROL" || command[0] == "ROR" || command[0] == "SHL" || command[0] == "SHR")
-        commands.rotateAndShift(command);
-    else if (command[0] == "IN")
-        commands.input(command);
-    else if (command[0] == "OUT")
-        commands.output(command);
-    else if (command[0] == "STORE")
-        commands.store(command);
-    else if (command[0] == "LOAD")
-        commands.load(command);
-    else
-        cerr << "Error: Invalid command on line " << counter << endl;
-}
 // Display registers, including PC (Program Counter)
-void displayRegisters()
-{
-    cout << setfill(' ') << setw(1) << "  0"
-         << setfill(' ') << setw(5)
-         << "1"
-         << setfill(' ') << setw(5)
-         << "2"
-         << setfill(' ') << setw(5)
-         << "3"
-         << setfill(' ') << setw(5)
-         << "4"
-         << setfill(' ') << setw(5)
-         << "5"
-         << setfill(' ') << setw(5)
-         << "6"
-         << setfill(' ') << setw(5) << endl;
+template <class Config>
+void displayRegisters(const BasicMachine<Config> &machine)
+{
+    // One column per register, the header follows the machine shape
+    cout << "  0";
+    for (int j = 1; j < Config::REGISTERS; j++)
+        cout << setfill(' ') << setw(5) << j;
+    cout << endl;
 
     cout << setw(0);
 
-    cout << setfill('-') << setw(35) << "";
+    cout << setfill('-') << setw(5 * Config::REGISTERS) << "";
     cout << "          " << setfill('-') << setw(3) << "" << endl;
 
     cout << "|";
-    for (int j = 0; j < REGISTER_SIZE; j++)
+    for (int j = 0; j < Config::REGISTERS; j++)
     {
-        cout << setfill(' ') << setw(3) << registers[j] << " |";
+        cout << setfill(' ') << setw(3) << (uint32_t)machine.registers[j] << " |";
     }
 
-    cout << "      PC |" << counter << "|";
-    counter++;
+    cout << "      PC |" << machine.pc << "|";
     cout << endl;
 
-    cout << setfill('-') << setw(35) << "";
+    cout << setfill('-') << setw(5 * Config::REGISTERS) << "";
     cout << "          " << setfill('-') << setw(3) << "" << endl;
 }
 
 // Display flags (CF, OF, UF, ZF)
-void displayFlags()
+template <class Config>
+void displayFlags(const BasicMachine<Config> &machine)
 {
     cout << "  CF"
          << "   OF"
@@ -510,71 +815,155 @@ void displayFlags()
 
     cout << "|";
     for (int i = 0; i < FLAGS_SIZE; i++)
-        cout << " " << (flags[i] ? '1' : ' ') << " | ";
+        cout << " " << ((machine.flags & (1 << i)) ? '1' : ' ') << " | ";
     cout << endl;
 
     cout << setfill('-') << setw(20) << "" << endl;
-
-    // Reset flags after displaying
-    for (int i = 0; i < FLAGS_SIZE; i++)
-        flags[i] = 0;
 }
 
 // Display memory contents
-void displayMemory()
-{
-    cout << "   0"
-         << setfill(' ') << setw(7)
-         << "1"
-         << setfill(' ') << setw(7)
-         << "2"
-         << setfill(' ') << setw(7)
-         << "3"
-         << setfill(' ') << setw(7)
-         << "4"
-         << setfill(' ') << setw(7)
-         << "5"
-         << setfill(' ') << setw(7)
-         << "6"
-         << setfill(' ') << setw(7)
-         << "7" << endl;
-
-    cout << setfill('-') << setw(55) << "" << endl;
-
-    for (int i = 0; i < MEMORY_SIZE; i++)
-    {
-        cout << setfill(' ') << setw(3);
+template <class Config>
+void displayMemory(const BasicMachine<Config> &machine)
+{
+    // Larger memories show only the rows holding a value, each behind its first address
+    const bool sparse = Config::MEMORY > MEMORY_SIZE;
+    const char *indent = sparse ? "       " : "";
 
-        if (i % 8 == 0)
-            cout << "|  ";
+    cout << indent << "   0";
+    for (int column = 1; column < 8; column++)
+        cout << setfill(' ') << setw(7) << column;
+    cout << endl;
 
-        if (memory[i] == 0)
-            cout << " ";
-        else
-            cout << memory[i];
+    cout << indent << setfill('-') << setw(55) << "" << endl;
 
-        cout << "  |"
-             << " ";
+    for (int row = 0; row < Config::MEMORY; row += 8)
+    {
+        if (sparse && all_of(machine.memory + row, machine.memory + row + 8, [](auto cell)
+                             { return cell == 0; }))
+            continue;
 
-        if ((i + 1) % 8 == 0)
+        if (sparse)
+            cout << setfill(' ') << setw(6) << row << " ";
+
+        for (int i = row; i < row + 8; i++)
         {
-            cout << endl;
-            cout << setfill('-') << setw(55) << "" << endl;
+            cout << setfill(' ') << setw(3);
+
+            if (i % 8 == 0)
+                cout << "|  ";
+
+            if (machine.memory[i] == 0)
+                cout << " ";
+            else
+                cout << (uint32_t)machine.memory[i];
+
+            cout << "  |"
+                 << " ";
         }
+
+        cout << endl;
+        cout << indent << setfill('-') << setw(55) << "" << endl;
     }
 
-    cout << setfill(' ') << setw(37) << ""
-         << "61"
-         << " "
-         << "    62"
-         << " "
-         << "    63";
+    // The last row is labelled under its last three cells
+    if (!sparse)
+        cout << setfill(' ') << setw(39) << Config::MEMORY - 3
+             << " " << setw(6) << Config::MEMORY - 2
+             << " " << setw(6) << Config::MEMORY - 1;
     cout << endl
          << endl;
 }
 
+// Function to print registers
+template <class Config>
+void printRegisters(ostream &output, const BasicMachine<Config> &machine)
+{
+    output << "Registers: ";
+
+    for (int i = 0; i < Config::REGISTERS; i++)
+    {
+        uint32_t r0 = machine.registers[i];
+        if (r0 == 0 && i != Config::REGISTERS - 1)
+        {
+            output << setw(4) << setfill('0') << r0 << " ";
+        }
+        else
+        {
+            output << r0 << " ";
+        }
+    }
+
+    output << "#\n";
+}
+
+// Function to print flags and PC
+template <class Config>
+void printFlagsAndPC(ostream &output, const BasicMachine<Config> &machine)
+{
+    output << "Flags    : ";
+    for (int i = 0; i < FLAGS_SIZE; i++)
+        output << ((machine.flags & (1 << i)) ? 1 : 0) << " ";
+    output << "#" << endl;
+    output << "PC       : " << machine.pc << endl;
+}
 
+// Function to print memory
+template <class Config>
+void printMemory(ostream &output, const BasicMachine<Config> &machine)
+{
+    output << "Memory:" << endl;
+    for (int i = 0; i < Config::MEMORY; i++)
+    {
+        uint32_t value = machine.memory[i];
+        if (value == 0 && (i % 8) == 0 && i == 0)
+        {
+            output << setw(4) << setfill('0') << value << " ";
+        }
+        else if (value == 0 && (i % 8) == 0 && i != 0)
+        {
+            output << endl;
+            output << setw(4) << setfill('0') << value << " ";
+        }
+        else if (value == 0 && (i % 8) != 0)
+        {
+            output << setw(4) << setfill('0') << value << " ";
+        }
+        else if (value > 0 && (i % 8) != 0)
+        {
+            output << setw(4) << setfill(' ') << value << " ";
+        }
+    }
+
+    output << endl
+           << "#\n";
+}
 
+// Function to print the complete final state of a machine
+template <class Config>
+void printState(ostream &output, const BasicMachine<Config> &machine)
+{
+    printRegisters(output, machine);
+    printFlagsAndPC(output, machine);
+    printMemory(output, machine);
+}
 
+// Function to execute the instruction at the program counter
+template <class Config>
+void step(BasicOperations<Config> &commands, BasicMachine<Config> &machine, const Program &program)
+{
+    // Advance first so a taken jump can overwrite the program counter
+    const Instruction &instruction = program.code[machine.pc++];
+    execute(commands, instruction);
+    machine.counter++;
+}
 
+// Function to run a decoded program to completion without any display
+template <class Config>
+void runProgram(BasicMachine<Config> &machine, const Program &program)
+{
+    BasicOperations<Config> operations(machine);
 
+    // The program halts when control runs past its last instruction
+    while (machine.pc < (int)program.code.size())
+        step(operations, machine, program);
+}
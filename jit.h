@@ -0,0 +1,792 @@
+#pragma once
+#include "function.h"
+#include <cstddef>
+#include <cstring>
+#include <sys/mman.h>
+
+// Native x86-64 code generator for decoded programs
+// Guest registers live in host registers and updateFlags is emitted inline after every result
+class JitProgram
+{
+private:
+    // Host register numbers in x86-64 encoding order
+    enum HostRegister
+    {
+        RAX = 0,
+        RCX = 1,
+        RDX = 2,
+        RBX = 3,
+        RBP = 5,
+        RSI = 6,
+        RDI = 7,
+        R8 = 8,
+        R9 = 9,
+        R10 = 10,
+        R11 = 11,
+        R12 = 12,
+        R13 = 13
+    };
+
+    // Host register of each guest register, RDI holds the Machine, ESI the flags, R13 the 64-bit counter
+    static constexpr int guestRegisters[REGISTER_SIZE] = {RBX, RBP, R8, R9, R10, R11, R12};
+    static const int FLAGS = RSI;
+    static const int COUNTER = R13;
+
+    // Indirect addresses are wrapped with a single AND
+    static_assert((MEMORY_SIZE & (MEMORY_SIZE - 1)) == 0, "memory size must be a power of two");
+
+    // Jump to a guest instruction whose native offset is known only after code generation
+    struct Fixup
+    {
+        size_t position;
+        int32_t target;
+    };
+
+    vector<uint8_t> code;
+    vector<Fixup> fixups;
+
+    // Whether the flags an instruction sets can still be read, dead flags are not computed
+    vector<bool> flagsLive;
+    bool keepFlags = true;
+    void *executable = nullptr;
+    size_t executableSize = 0;
+
+    void emit(uint8_t value) { code.push_back(value); }
+    void emit32(int32_t value);
+    void rex(int reg, int rm, bool byteRegister = false);
+    void rexWide(int reg, int rm) { emit((uint8_t)(0x48 | ((reg >> 3) << 2) | (rm >> 3))); }
+    void modrm(int mode, int reg, int rm) { emit((uint8_t)((mode << 6) | ((reg & 7) << 3) | (rm & 7))); }
+
+    // Instruction encoders, all on 32-bit registers unless noted
+    void movRegReg(int destination, int source);
+    void movRegImm(int destination, int32_t value);
+    void aluRegReg(uint8_t opcode, int destination, int source);
+    void aluRegImm(int extension, int destination, int32_t value);
+    void conditionalMove(uint8_t condition, int destination, int source);
+    void loadByte(int destination, int32_t displacement);
+    void loadByteIndexed(int destination);
+    void storeByte(int32_t displacement, int source);
+    void storeByteIndexed(int source);
+    size_t jumpShort(uint8_t opcode);
+    void land(size_t position);
+    void jumpGuest(uint8_t condition, int32_t target);
+
+    // Guest level helpers
+    void loadOperand(int destination, AddressMode mode, int32_t operand);
+    void emitResult(int guestRegister, bool overflow, bool underflow);
+    void analyzeFlags(const Program &program);
+    bool emitInstruction(const Instruction &instruction);
+
+public:
+    JitProgram() = default;
+    JitProgram(const JitProgram &) = delete;
+    JitProgram &operator=(const JitProgram &) = delete;
+    ~JitProgram();
+
+    // Method to compile a program, false if it uses something the JIT does not support
+    bool compile(const Program &program);
+
+    // Method to run the compiled program on a machine from its first instruction
+    void run(Machine &machine) const;
+};
+
+JitProgram::~JitProgram()
+{
+    if (executable != nullptr)
+        munmap(executable, executableSize);
+}
+
+void JitProgram::emit32(int32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        emit((uint8_t)(value >> (8 * i)));
+}
+
+void JitProgram::rex(int reg, int rm, bool byteRegister)
+{
+    uint8_t prefix = 0x40 | ((reg >> 3) << 2) | (rm >> 3);
+
+    // SPL, BPL, SIL and DIL need an empty REX prefix to be addressed as bytes
+    if (prefix != 0x40 || (byteRegister && reg >= 4 && reg < 8))
+        emit(prefix);
+}
+
+void JitProgram::movRegReg(int destination, int source)
+{
+    rex(source, destination);
+    emit(0x89);
+    modrm(3, source, destination);
+}
+
+void JitProgram::movRegImm(int destination, int32_t value)
+{
+    rex(0, destination);
+    emit((uint8_t)(0xB8 + (destination & 7)));
+    emit32(value);
+}
+
+void JitProgram::aluRegReg(uint8_t opcode, int destination, int source)
+{
+    rex(source, destination);
+    emit(opcode);
+    modrm(3, source, destination);
+}
+
+void JitProgram::aluRegImm(int extension, int destination, int32_t value)
+{
+    // Small constants use the sign-extended byte form
+    bool small = value >= -128 && value <= 127;
+    rex(0, destination);
+    emit(small ? 0x83 : 0x81);
+    modrm(3, extension, destination);
+    if (small)
+        emit((uint8_t)value);
+    else
+        emit32(value);
+}
+
+void JitProgram::conditionalMove(uint8_t condition, int destination, int source)
+{
+    rex(destination, source);
+    emit(0x0F);
+    emit((uint8_t)(0x40 | condition));
+    modrm(3, destination, source);
+}
+
+void JitProgram::loadByte(int destination, int32_t displacement)
+{
+    // movzx destination, byte [rdi + displacement]
+    rex(destination, RDI);
+    emit(0x0F);
+    emit(0xB6);
+    modrm(2, destination, RDI);
+    emit32(displacement);
+}
+
+void JitProgram::loadByteIndexed(int destination)
+{
+    // movzx destination, byte [rdi + rax + memory], the displacement keeps it right wherever memory sits in Machine
+    rex(destination, 0);
+    emit(0x0F);
+    emit(0xB6);
+    modrm(2, destination, 4);
+    emit(0x07);
+    emit32((int32_t)offsetof(Machine, memory));
+}
+
+void JitProgram::storeByte(int32_t displacement, int source)
+{
+    // mov byte [rdi + displacement], source
+    rex(source, RDI, true);
+    emit(0x88);
+    modrm(2, source, RDI);
+    emit32(displacement);
+}
+
+void JitProgram::storeByteIndexed(int source)
+{
+    // mov byte [rdi + rax + memory], source
+    rex(source, 0, true);
+    emit(0x88);
+    modrm(2, source, 4);
+    emit(0x07);
+    emit32((int32_t)offsetof(Machine, memory));
+}
+
+size_t JitProgram::jumpShort(uint8_t opcode)
+{
+    emit(opcode);
+    emit(0);
+    return code.size() - 1;
+}
+
+void JitProgram::land(size_t position)
+{
+    code[position] = (uint8_t)(code.size() - position - 1);
+}
+
+void JitProgram::jumpGuest(uint8_t condition, int32_t target)
+{
+    // 0 is an unconditional jmp, anything else the second byte of a near jcc
+    if (condition == 0)
+        emit(0xE9);
+    else
+    {
+        emit(0x0F);
+        emit(condition);
+    }
+    fixups.push_back({code.size(), target});
+    emit32(0);
+}
+
+void JitProgram::loadOperand(int destination, AddressMode mode, int32_t operand)
+{
+    if (mode == MODE_REGISTER)
+        movRegReg(destination, guestRegisters[operand]);
+    else
+        movRegImm(destination, operand);
+}
+
+void JitProgram::emitResult(int guestRegister, bool overflow, bool underflow)
+{
+    // updateFlags inline and without branches: EAX holds the raw result, the clamped value goes to the guest register
+    // overflow and underflow say whether the result can leave the word range at all
+    aluRegReg(0x31, RCX, RCX);
+    if (keepFlags)
+        aluRegReg(0x31, FLAGS, FLAGS);
+
+    if (overflow)
+    {
+        aluRegImm(7, RAX, 255);
+        conditionalMove(0xF, RAX, RCX); // cmovg eax, ecx
+        if (keepFlags)
+        {
+            movRegImm(RDX, FLAG_CF | FLAG_OF);
+            conditionalMove(0xF, FLAGS, RDX);
+        }
+    }
+
+    aluRegReg(0x85, RAX, RAX);
+    if (underflow)
+    {
+        movRegImm(RDX, 255);
+        conditionalMove(0x8, RAX, RDX); // cmovs eax, edx
+        if (keepFlags)
+        {
+            movRegImm(RDX, FLAG_UF);
+            conditionalMove(0x8, FLAGS, RDX);
+        }
+    }
+
+    // Zero sets ZF, which also covers the overflow case that was cleared to 0
+    if (keepFlags)
+    {
+        emit(0x0F); // sete cl
+        emit(0x94);
+        modrm(3, 0, RCX);
+        emit(0xC1); // shl ecx, 3
+        modrm(3, 4, RCX);
+        emit(3);
+        aluRegReg(0x09, FLAGS, RCX);
+    }
+    movRegReg(guestRegister, RAX);
+}
+
+void JitProgram::analyzeFlags(const Program &program)
+{
+    int32_t size = (int32_t)program.code.size();
+    auto readsFlags = [](Opcode opcode) { return opcode == OP_JZ || opcode == OP_JNZ || opcode == OP_JC; };
+    auto writesFlags = [](Opcode opcode) { return opcode != OP_STORE && opcode != OP_LOAD && opcode != OP_OUT && (opcode < OP_JMP || opcode > OP_JC); };
+
+    // Backwards liveness over the control flow graph, the final flags are always shown in the dump
+    vector<bool> liveIn(size + 1, false);
+    liveIn[size] = true;
+    flagsLive.assign(size, false);
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int32_t i = size - 1; i >= 0; i--)
+        {
+            const Instruction &instruction = program.code[i];
+            bool live = instruction.opcode != OP_JMP && liveIn[i + 1];
+            if (instruction.dstMode == MODE_TARGET && instruction.dst >= 0 && instruction.dst <= size)
+                live = live || liveIn[instruction.dst];
+            flagsLive[i] = live;
+
+            bool in = readsFlags(instruction.opcode) || (!writesFlags(instruction.opcode) && live);
+            if (in != liveIn[i])
+            {
+                liveIn[i] = in;
+                changed = true;
+            }
+        }
+    }
+}
+
+bool JitProgram::emitInstruction(const Instruction &instruction)
+{
+    // Every instruction counts, like machine.counter++ in step()
+    rexWide(0, COUNTER);
+    emit(0xFF);
+    modrm(3, 0, COUNTER);
+
+    int destination = instruction.dstMode == MODE_REGISTER ? guestRegisters[instruction.dst] : -1;
+
+    switch (instruction.opcode)
+    {
+    case OP_MOV:
+        if (instruction.srcMode == MODE_IMMEDIATE)
+        {
+            // Constant moves are clamped and flagged at compile time
+            int value = instruction.src;
+            int flags = value > 255 ? FLAG_CF | FLAG_OF | FLAG_ZF : value < 0 ? FLAG_UF : value == 0 ? FLAG_ZF : 0;
+            value = value > 255 ? 0 : value < 0 ? 255 : value;
+            movRegImm(destination, value);
+            if (keepFlags)
+                movRegImm(FLAGS, flags);
+            return true;
+        }
+        if (instruction.srcMode == MODE_INDIRECT)
+        {
+            // The address wraps around memory like wrapAddress
+            movRegReg(RAX, guestRegisters[instruction.src]);
+            aluRegImm(4, RAX, MEMORY_SIZE - 1);
+            loadByteIndexed(RAX);
+        }
+        else
+            loadOperand(RAX, instruction.srcMode, instruction.src);
+        emitResult(destination, false, false);
+        return true;
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    {
+        // Registers and small constants bound which way the result can leave the word range
+        bool constant = instruction.srcMode == MODE_IMMEDIATE;
+        bool small = !constant || (instruction.src >= -65536 && instruction.src <= 65536);
+        bool negative = constant && instruction.src < 0;
+        bool overflow = !small, underflow = !small;
+        if (instruction.opcode == OP_ADD || instruction.opcode == OP_MUL)
+        {
+            overflow = overflow || !negative;
+            underflow = underflow || negative;
+        }
+        else if (instruction.opcode == OP_SUB)
+        {
+            overflow = overflow || negative;
+            underflow = underflow || !negative;
+        }
+        else
+            underflow = underflow || negative;
+
+        movRegReg(RAX, destination);
+        loadOperand(RCX, instruction.srcMode, instruction.src);
+        if (instruction.opcode == OP_ADD)
+            aluRegReg(0x01, RAX, RCX);
+        else if (instruction.opcode == OP_SUB)
+            aluRegReg(0x29, RAX, RCX);
+        else if (instruction.opcode == OP_MUL)
+        {
+            // imul eax, ecx
+            emit(0x0F);
+            emit(0xAF);
+            modrm(3, RAX, RCX);
+        }
+        else
+        {
+            // Division by zero leaves the value as it is
+            aluRegReg(0x85, RCX, RCX);
+            size_t byZero = jumpShort(0x74);
+            emit(0x99); // cdq
+            emit(0xF7); // idiv ecx
+            modrm(3, 7, RCX);
+            land(byZero);
+        }
+        emitResult(destination, overflow, underflow);
+        return true;
+    }
+
+    case OP_INC:
+    case OP_DEC:
+        movRegReg(RAX, destination);
+        aluRegImm(instruction.opcode == OP_INC ? 0 : 5, RAX, 1);
+        emitResult(destination, instruction.opcode == OP_INC, instruction.opcode == OP_DEC);
+        return true;
+
+    case OP_ROL:
+    case OP_ROR:
+    case OP_SHL:
+    case OP_SHR:
+    {
+        // The amount is a constant, so the carry bit position is known now
+        int amount = instruction.src;
+        if (amount < 0)
+            return false;
+        int rotate = amount % WORD_BITS;
+        int carryBit = -1;
+        movRegReg(RAX, destination);
+
+        if (instruction.opcode == OP_ROL || instruction.opcode == OP_ROR)
+        {
+            if (rotate != 0)
+            {
+                // rol/ror al, rotate
+                emit(0xC0);
+                modrm(3, instruction.opcode == OP_ROL ? 0 : 1, RAX);
+                emit((uint8_t)rotate);
+                carryBit = instruction.opcode == OP_ROL ? 0 : WORD_BITS - 1;
+            }
+        }
+        else if (amount > WORD_BITS)
+            aluRegReg(0x31, RAX, RAX);
+        else if (amount > 0)
+        {
+            // The carry is taken from the original value before shifting
+            carryBit = instruction.opcode == OP_SHL ? WORD_BITS - amount : amount - 1;
+            movRegReg(RDX, RAX);
+            emit(0xC1);
+            modrm(3, instruction.opcode == OP_SHL ? 4 : 5, RAX);
+            emit((uint8_t)amount);
+            aluRegImm(4, RAX, 0xFF);
+        }
+
+        movRegReg(destination, RAX);
+        if (!keepFlags)
+            return true;
+
+        // Flags are ZF from the result plus CF from the bit moved out
+        aluRegReg(0x31, FLAGS, FLAGS);
+        aluRegReg(0x85, RAX, RAX);
+        size_t nonZero = jumpShort(0x75);
+        movRegImm(FLAGS, FLAG_ZF);
+        land(nonZero);
+        if (carryBit >= 0)
+        {
+            int source = instruction.opcode == OP_ROL || instruction.opcode == OP_ROR ? RAX : RDX;
+            movRegReg(RCX, source);
+            emit(0xC1);
+            modrm(3, 5, RCX);
+            emit((uint8_t)carryBit);
+            aluRegImm(4, RCX, 1);
+            aluRegReg(0x09, FLAGS, RCX);
+        }
+        return true;
+    }
+
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOT:
+        movRegReg(RAX, destination);
+        if (instruction.opcode == OP_NOT)
+            aluRegImm(6, RAX, 0xFF);
+        else
+        {
+            if (instruction.srcMode == MODE_IMMEDIATE)
+                movRegImm(RCX, instruction.src & 0xFF);
+            else
+                movRegReg(RCX, guestRegisters[instruction.src]);
+            aluRegReg(instruction.opcode == OP_AND ? 0x21 : instruction.opcode == OP_OR ? 0x09 : 0x31, RAX, RCX);
+        }
+        emitResult(destination, false, false);
+        return true;
+
+    case OP_STORE:
+    {
+        int source = guestRegisters[instruction.src];
+        if (instruction.dstMode == MODE_INDIRECT)
+        {
+            movRegReg(RAX, guestRegisters[instruction.dst]);
+            aluRegImm(4, RAX, MEMORY_SIZE - 1);
+            storeByteIndexed(source);
+        }
+        else
+            storeByte((int32_t)offsetof(Machine, memory) + instruction.dst, source);
+        return true;
+    }
+
+    case OP_LOAD:
+        if (instruction.srcMode == MODE_INDIRECT)
+        {
+            movRegReg(RAX, guestRegisters[instruction.src]);
+            aluRegImm(4, RAX, MEMORY_SIZE - 1);
+            loadByteIndexed(destination);
+        }
+        else
+            loadByte(destination, (int32_t)offsetof(Machine, memory) + instruction.src);
+        return true;
+
+    case OP_CMP:
+    {
+        // Compare only produces flags
+        if (!keepFlags)
+            return true;
+
+        // Clear the flags first, the subtraction sets the host flags tested below
+        aluRegReg(0x31, FLAGS, FLAGS);
+        movRegReg(RAX, destination);
+        loadOperand(RCX, instruction.srcMode, instruction.src);
+        aluRegReg(0x29, RAX, RCX);
+        size_t nonZero = jumpShort(0x75);
+        movRegImm(FLAGS, FLAG_ZF);
+        size_t done = jumpShort(0xEB);
+        land(nonZero);
+        size_t positive = jumpShort(0x79);
+        movRegImm(FLAGS, FLAG_CF | FLAG_UF);
+        land(positive);
+        land(done);
+        return true;
+    }
+
+    case OP_JMP:
+        jumpGuest(0, instruction.dst);
+        return true;
+    case OP_JZ:
+    case OP_JNZ:
+    case OP_JC:
+        // test esi, flag then jnz or jz to the target
+        emit(0xF7);
+        modrm(3, 0, FLAGS);
+        emit32(instruction.opcode == OP_JC ? FLAG_CF : FLAG_ZF);
+        jumpGuest(instruction.opcode == OP_JZ ? 0x85 : instruction.opcode == OP_JNZ ? 0x84 : 0x85, instruction.dst);
+        return true;
+
+    case OP_INCN:
+    case OP_DECN:
+    {
+        movRegReg(RAX, destination);
+        aluRegImm(instruction.opcode == OP_INCN ? 0 : 5, RAX, instruction.src);
+        aluRegImm(4, RAX, 0xFF);
+        movRegReg(destination, RAX);
+        if (!keepFlags)
+            return true;
+
+        aluRegReg(0x31, FLAGS, FLAGS);
+        if (instruction.opcode == OP_INCN)
+        {
+            aluRegReg(0x85, RAX, RAX);
+            size_t nonZero = jumpShort(0x75);
+            movRegImm(FLAGS, FLAG_CF | FLAG_OF | FLAG_ZF);
+            land(nonZero);
+        }
+        else
+        {
+            aluRegImm(7, RAX, 255);
+            size_t notFull = jumpShort(0x75);
+            movRegImm(FLAGS, FLAG_UF);
+            size_t done = jumpShort(0xEB);
+            land(notFull);
+            aluRegReg(0x85, RAX, RAX);
+            size_t nonZero = jumpShort(0x75);
+            movRegImm(FLAGS, FLAG_ZF);
+            land(nonZero);
+            land(done);
+        }
+        return true;
+    }
+
+    case OP_ADDM:
+    {
+        int registerHost = guestRegisters[instruction.aux];
+        int32_t displacement = (int32_t)offsetof(Machine, memory) + instruction.dst;
+
+        loadByte(registerHost, displacement);
+        movRegReg(RAX, registerHost);
+        loadOperand(RCX, instruction.srcMode, instruction.src);
+        aluRegReg(0x01, RAX, RCX);
+        emitResult(registerHost, true, true);
+        storeByte(displacement, registerHost);
+        return true;
+    }
+
+    default:
+        // IN and OUT talk to the outside world and stay in the interpreter, so do the block instructions
+        return false;
+    }
+}
+
+bool JitProgram::compile(const Program &program)
+{
+#if defined(__x86_64__)
+    int32_t size = (int32_t)program.code.size();
+    vector<size_t> offsets(size + 1);
+
+    // Prologue: save callee-saved registers, load guest state into host registers
+    emit(0x53);             // push rbx
+    emit(0x55);             // push rbp
+    emit(0x41); // push r12
+    emit(0x54);
+    emit(0x41); // push r13
+    emit(0x55);
+    for (int i = 0; i < REGISTER_SIZE; i++)
+        loadByte(guestRegisters[i], (int32_t)offsetof(Machine, registers) + i);
+    loadByte(FLAGS, (int32_t)offsetof(Machine, flags));
+    rexWide(COUNTER, RDI);
+    emit(0x8B);
+    modrm(2, COUNTER, RDI);
+    emit32((int32_t)offsetof(Machine, counter));
+
+    analyzeFlags(program);
+    for (int32_t i = 0; i < size; i++)
+    {
+        offsets[i] = code.size();
+        keepFlags = flagsLive[i];
+        if (!emitInstruction(program.code[i]))
+            return false;
+    }
+
+    // Epilogue: write guest state back and report the program as halted
+    offsets[size] = code.size();
+    for (int i = 0; i < REGISTER_SIZE; i++)
+        storeByte((int32_t)offsetof(Machine, registers) + i, guestRegisters[i]);
+    storeByte((int32_t)offsetof(Machine, flags), FLAGS);
+    rexWide(COUNTER, RDI);
+    emit(0x89);
+    modrm(2, COUNTER, RDI);
+    emit32((int32_t)offsetof(Machine, counter));
+    emit(0xC7); // mov dword [rdi + pc], size
+    modrm(2, 0, RDI);
+    emit32((int32_t)offsetof(Machine, pc));
+    emit32(size);
+    emit(0x41); // pop r13
+    emit(0x5D);
+    emit(0x41); // pop r12
+    emit(0x5C);
+    emit(0x5D);             // pop rbp
+    emit(0x5B);             // pop rbx
+    emit(0xC3);             // ret
+
+    // Guest jumps become direct native jumps
+    for (const Fixup &fixup : fixups)
+    {
+        int32_t relative = (int32_t)(offsets[fixup.target] - (fixup.position + 4));
+        memcpy(&code[fixup.position], &relative, 4);
+    }
+
+    // Copy into fresh pages and make them executable but no longer writable
+    executableSize = code.size();
+    void *pages = mmap(nullptr, executableSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED)
+        return false;
+    memcpy(pages, code.data(), executableSize);
+    if (mprotect(pages, executableSize, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(pages, executableSize);
+        return false;
+    }
+    executable = pages;
+    return true;
+#else
+    (void)program;
+    return false;
+#endif
+}
+
+void JitProgram::run(Machine &machine) const
+{
+    ((void (*)(Machine *))executable)(&machine);
+}
+
+// Function to compile a program once for all of its runs, null if it has to be interpreted instead
+shared_ptr<const JitProgram> compileJit(const Program &program)
+{
+    auto compiled = make_shared<JitProgram>();
+    if (!compiled->compile(program))
+        return nullptr;
+    return compiled;
+}
+
+// Function to run a program as native code, false if it has to be interpreted instead
+bool runJit(Machine &machine, const Program &program)
+{
+    // Compiled code always starts at the first instruction
+    if (machine.pc != 0)
+        return false;
+
+    JitProgram compiled;
+    if (!compiled.compile(program))
+        return false;
+
+    compiled.run(machine);
+    return true;
+}
+
+// Function to run a program both compiled and interpreted and compare the final dumps
+// Returns false on a mismatch, compiled is false when the program could not be compiled
+bool verifyJit(const Program &program, bool &compiled, string &interpreted, string &native)
+{
+    Machine interpreterMachine;
+    Machine jitMachine;
+
+    runProgram(interpreterMachine, program);
+    compiled = runJit(jitMachine, program);
+    if (!compiled)
+        runProgram(jitMachine, program);
+
+    ostringstream interpreterState, jitState;
+    printState(interpreterState, interpreterMachine);
+    printState(jitState, jitMachine);
+    interpreted = interpreterState.str();
+    native = jitState.str();
+
+    // The counter is not in the dump but must match as well
+    return interpreted == native && interpreterMachine.counter == jitMachine.counter;
+}
+
+// Function to write a random program of everything the native code generator supports, the same seed gives the same program
+// Operands sit on the flag and wrap edges of the word, memory is reached directly and through wrapped indirect addresses,
+// jumps go forward on every condition and counted loops go backward
+string generateJitProgram(uint64_t seed)
+{
+    static const char *const binary[] = {"MOV", "ADD", "SUB", "MUL", "DIV", "AND", "OR", "XOR", "CMP"};
+    static const char *const unary[] = {"INC", "DEC", "NOT"};
+    static const char *const shifts[] = {"ROL", "ROR", "SHL", "SHR"};
+    static const char *const jumps[] = {"JZ", "JNZ", "JC", "JMP"};
+    static const int edges[] = {0, 1, 2, 3, 7, 64, 100, 127, 128, 255, 256, -1, -3, 1000, 70000, -70000, -256, 1 << 20};
+
+    uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 88172645463325252ULL;
+    auto next = [&state](uint64_t range)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state % range;
+    };
+
+    // The last register is left to the loop counters, so every loop ends
+    auto guest = [&]()
+    { return "R" + to_string(next(REGISTER_SIZE - 1)); };
+    auto operand = [&]()
+    { return next(2) ? guest() : to_string(edges[next(sizeof(edges) / sizeof(edges[0]))]); };
+    const string counter = "R" + to_string(REGISTER_SIZE - 1);
+
+    ostringstream text;
+    int labels = 0;
+    for (int line = 0; line < 120; line++)
+    {
+        uint64_t kind = next(10);
+        string target = guest();
+        if (kind < 5)
+            text << binary[next(9)] << " " << operand() << ", " << target << "\n";
+        else if (kind < 6)
+            text << unary[next(3)] << " " << target << "\n";
+        else if (kind < 7)
+            text << shifts[next(4)] << " " << target << ", " << next(12) << "\n";
+        else if (kind < 8)
+        {
+            switch (next(5))
+            {
+            case 0:
+                text << "STORE " << target << ", " << next(MEMORY_SIZE) << "\n";
+                break;
+            case 1:
+                text << "STORE " << target << ", [" << guest() << "]\n";
+                break;
+            case 2:
+                text << "LOAD " << target << ", " << next(MEMORY_SIZE) << "\n";
+                break;
+            case 3:
+                text << "LOAD " << target << ", [" << guest() << "]\n";
+                break;
+            default:
+                text << "MOV [" << guest() << "], " << target << "\n";
+            }
+        }
+        else if (kind < 9)
+        {
+            labels++;
+            text << jumps[next(4)] << " F" << labels << "\nINC " << target << "\nF" << labels << ": DEC " << target << "\n";
+        }
+        else
+        {
+            labels++;
+            text << "MOV " << 1 + next(19) << ", " << counter << "\nB" << labels << ": ADD " << operand() << ", " << target
+                 << "\nDEC " << counter << "\nJNZ B" << labels << "\n";
+        }
+    }
+    return text.str();
+}
@@ -0,0 +1,465 @@
+#pragma once
+#include "function.h"
+#include "optimizer.h"
+#include <algorithm>
+#include <cstring>
+
+// Number of lanes run in lockstep, a multiple of every host vector width
+const int LANES = 16;
+
+// Structure-of-arrays state of a group of lanes, every register and memory cell holds one value per lane
+// Values are 32 bits wide so raw results can be clamped exactly like updateFlags does
+struct LaneGroup
+{
+    alignas(32) int32_t memory[MEMORY_SIZE][LANES] = {};
+    alignas(32) int32_t registers[REGISTER_SIZE][LANES] = {};
+    alignas(32) int32_t flags[LANES] = {};
+    alignas(32) int32_t pc[LANES] = {};
+    alignas(32) int32_t counter[LANES] = {}; // Instructions since the last fold into total
+    int64_t total[LANES] = {};               // Instructions executed by each lane
+
+    // IN and OUT stay per lane
+    InputBuffer input[LANES];
+    OutputBuffer output[LANES];
+};
+
+#if defined(__GNUC__)
+#define LANES_SIMD 1
+// The helpers are always inlined, so the ABI note for AVX vector arguments does not apply
+#pragma GCC diagnostic ignored "-Wpsabi"
+#define LANE_INLINE inline __attribute__((always_inline))
+
+// Host vectors of 32-bit lanes, SSE2 and NEON registers hold four, AVX2 registers eight
+typedef int32_t Vector4 __attribute__((vector_size(16)));
+typedef int32_t Vector8 __attribute__((vector_size(32)));
+
+// Function to load the lanes of one vector starting at a lane offset
+template <class Vector>
+LANE_INLINE Vector laneLoad(const int32_t *lanes)
+{
+    Vector value;
+    memcpy(&value, lanes, sizeof(value));
+    return value;
+}
+
+// Function to store the lanes of one vector starting at a lane offset
+template <class Vector>
+LANE_INLINE void laneStore(int32_t *lanes, const Vector &value)
+{
+    memcpy(lanes, &value, sizeof(value));
+}
+
+// Function to take a where the mask is set and b elsewhere
+template <class Vector>
+LANE_INLINE Vector laneSelect(const Vector &mask, const Vector &a, const Vector &b)
+{
+    return (a & mask) | (b & ~mask);
+}
+
+// Function to clamp raw results of every lane exactly like updateFlags, returning the new flags
+template <class Vector>
+LANE_INLINE Vector laneUpdateFlags(Vector &value)
+{
+    Vector zeros = {};
+    Vector over = value > 255;
+    Vector under = value < 0;
+
+    value = laneSelect(over, zeros, laneSelect(under, zeros + 255, value));
+    Vector zero = value == 0;
+    return (over & (FLAG_CF | FLAG_OF)) | (under & FLAG_UF) | (zero & FLAG_ZF);
+}
+
+// Function to get a register or broadcast constant operand
+template <class Vector>
+LANE_INLINE Vector laneOperand(const LaneGroup &group, AddressMode mode, int32_t operand, int offset)
+{
+    if (mode == MODE_REGISTER)
+        return laneLoad<Vector>(&group.registers[operand][offset]);
+    return Vector{} + operand;
+}
+
+static_assert((MEMORY_SIZE & (MEMORY_SIZE - 1)) == 0, "lane addresses wrap with a mask");
+
+// Function to read memory at a per-lane address held in a register, addresses wrap like the interpreter's
+template <class Vector>
+LANE_INLINE Vector laneGather(const LaneGroup &group, int registerIndex, const Vector &mask, int offset)
+{
+    Vector value = {};
+    for (int lane = 0; lane < (int)(sizeof(Vector) / sizeof(int32_t)); lane++)
+    {
+        uint32_t address = (uint32_t)group.registers[registerIndex][offset + lane] & (MEMORY_SIZE - 1);
+        if (mask[lane])
+            value[lane] = group.memory[address][offset + lane];
+    }
+    return value;
+}
+
+// Function to write a value to the lanes of the mask
+template <class Vector>
+LANE_INLINE void laneWrite(int32_t *lanes, const Vector &value, const Vector &mask)
+{
+    laneStore(lanes, laneSelect(mask, value, laneLoad<Vector>(lanes)));
+}
+
+// Function to clamp a result, then write it and its flags to the lanes of the mask
+template <class Vector>
+LANE_INLINE void laneWriteResult(LaneGroup &group, int registerIndex, const Vector &result, const Vector &mask, int offset)
+{
+    Vector raw = result;
+    Vector flags = laneUpdateFlags(raw);
+    laneWrite(&group.registers[registerIndex][offset], raw, mask);
+    laneWrite(&group.flags[offset], flags, mask);
+}
+
+// Function to execute one instruction on the lanes of one vector whose program counter is pc
+template <class Vector>
+LANE_INLINE void laneExecute(LaneGroup &group, const Instruction &instruction, int pc, int offset)
+{
+    const int width = sizeof(Vector) / sizeof(int32_t);
+    Vector zeros = {};
+    Vector mask = laneLoad<Vector>(&group.pc[offset]) == pc;
+    int dst = instruction.dst;
+    int32_t *destination = dst >= 0 && dst < REGISTER_SIZE ? &group.registers[dst][offset] : nullptr;
+
+    laneStore(&group.counter[offset], laneLoad<Vector>(&group.counter[offset]) - mask);
+
+    switch (instruction.opcode)
+    {
+    case OP_MOV:
+    {
+        Vector value = instruction.srcMode == MODE_INDIRECT ? laneGather(group, instruction.src, mask, offset)
+                                                            : laneOperand<Vector>(group, instruction.srcMode, instruction.src, offset);
+        laneWriteResult(group, dst, value, mask, offset);
+        break;
+    }
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    {
+        Vector current = laneLoad<Vector>(destination);
+        Vector source = laneOperand<Vector>(group, instruction.srcMode, instruction.src, offset);
+        Vector raw;
+        if (instruction.opcode == OP_ADD)
+            raw = current + source;
+        else if (instruction.opcode == OP_SUB)
+            raw = current - source;
+        else if (instruction.opcode == OP_MUL)
+            raw = current * source;
+        else
+        {
+            // Division by zero keeps the value, the divisor is made safe for every lane first
+            Vector byZero = source == 0;
+            raw = laneSelect(byZero, current, current / laneSelect(byZero, zeros + 1, source));
+        }
+        laneWriteResult(group, dst, raw, mask, offset);
+        break;
+    }
+    case OP_INC:
+        laneWriteResult(group, dst, laneLoad<Vector>(destination) + 1, mask, offset);
+        break;
+    case OP_DEC:
+        laneWriteResult(group, dst, laneLoad<Vector>(destination) - 1, mask, offset);
+        break;
+    case OP_ROL:
+    case OP_ROR:
+    case OP_SHL:
+    case OP_SHR:
+    {
+        // The amount is the same for every lane, the same cases as the scalar ALU
+        Vector current = laneLoad<Vector>(destination);
+        Vector result = current;
+        Vector carry = zeros;
+        int amount = instruction.src;
+        int rotate = amount % WORD_BITS;
+
+        if (instruction.opcode == OP_ROL && rotate != 0)
+        {
+            result = ((current << rotate) | (current >> (WORD_BITS - rotate))) & 0xFF;
+            carry = result & 1;
+        }
+        else if (instruction.opcode == OP_ROR && rotate != 0)
+        {
+            result = ((current >> rotate) | (current << (WORD_BITS - rotate))) & 0xFF;
+            carry = (result >> (WORD_BITS - 1)) & 1;
+        }
+        else if ((instruction.opcode == OP_SHL || instruction.opcode == OP_SHR) && amount > WORD_BITS)
+            result = zeros;
+        else if (instruction.opcode == OP_SHL && amount > 0)
+        {
+            carry = (current >> (WORD_BITS - amount)) & 1;
+            result = (current << amount) & 0xFF;
+        }
+        else if (instruction.opcode == OP_SHR && amount > 0)
+        {
+            carry = (current >> (amount - 1)) & 1;
+            result = current >> amount;
+        }
+
+        Vector flags = laneUpdateFlags(result) | ((carry != 0) & FLAG_CF);
+        laneWrite(destination, result, mask);
+        laneWrite(&group.flags[offset], flags, mask);
+        break;
+    }
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOT:
+    {
+        Vector current = laneLoad<Vector>(destination);
+        Vector result;
+        if (instruction.opcode == OP_NOT)
+            result = ~current & 0xFF;
+        else
+        {
+            Vector source = laneOperand<Vector>(group, instruction.srcMode, instruction.src, offset) & 0xFF;
+            if (instruction.opcode == OP_AND)
+                result = current & source;
+            else if (instruction.opcode == OP_OR)
+                result = current | source;
+            else
+                result = current ^ source;
+        }
+        laneWriteResult(group, dst, result, mask, offset);
+        break;
+    }
+    case OP_IN:
+    {
+        Vector value = zeros;
+        for (int lane = 0; lane < width; lane++)
+        {
+            int inputValue = 0;
+            if (mask[lane] && !group.input[offset + lane].read(inputValue))
+                cerr << "Error: No input left for IN, reading 0." << endl;
+            value[lane] = inputValue;
+        }
+        laneWriteResult(group, dst, value, mask, offset);
+        break;
+    }
+    case OP_OUT:
+    {
+        Vector value = laneOperand<Vector>(group, instruction.srcMode, instruction.src, offset);
+        for (int lane = 0; lane < width; lane++)
+            if (mask[lane])
+                group.output[offset + lane].write(value[lane]);
+        break;
+    }
+    case OP_STORE:
+    {
+        Vector value = laneLoad<Vector>(&group.registers[instruction.src][offset]);
+        if (instruction.dstMode == MODE_INDIRECT)
+        {
+            // Every lane may write a different cell
+            for (int lane = 0; lane < width; lane++)
+            {
+                uint32_t address = (uint32_t)destination[lane] & (MEMORY_SIZE - 1);
+                if (mask[lane])
+                    group.memory[address][offset + lane] = value[lane];
+            }
+        }
+        else
+            laneWrite(&group.memory[dst][offset], value, mask);
+        break;
+    }
+    case OP_LOAD:
+    {
+        Vector value;
+        if (instruction.srcMode == MODE_INDIRECT)
+            value = laneGather(group, instruction.src, mask, offset);
+        else
+            value = laneLoad<Vector>(&group.memory[instruction.src][offset]);
+        laneWrite(destination, value, mask);
+        break;
+    }
+    case OP_CMP:
+    {
+        Vector difference = laneLoad<Vector>(destination) - laneOperand<Vector>(group, instruction.srcMode, instruction.src, offset);
+        Vector flags = ((difference == 0) & FLAG_ZF) | ((difference < 0) & (FLAG_CF | FLAG_UF));
+        laneWrite(&group.flags[offset], flags, mask);
+        break;
+    }
+    case OP_JMP:
+    case OP_JZ:
+    case OP_JNZ:
+    case OP_JC:
+    {
+        // Lanes that take the jump go to the target, the others to the next instruction
+        Vector flags = laneLoad<Vector>(&group.flags[offset]);
+        Vector taken = mask;
+        if (instruction.opcode == OP_JZ)
+            taken &= (flags & FLAG_ZF) != 0;
+        else if (instruction.opcode == OP_JNZ)
+            taken &= (flags & FLAG_ZF) == 0;
+        else if (instruction.opcode == OP_JC)
+            taken &= (flags & FLAG_CF) != 0;
+        Vector next = laneSelect(taken, zeros + dst, laneSelect(mask, zeros + (pc + 1), laneLoad<Vector>(&group.pc[offset])));
+        laneStore(&group.pc[offset], next);
+        return;
+    }
+    case OP_INCN:
+    case OP_DECN:
+    {
+        Vector result;
+        Vector flags;
+        if (instruction.opcode == OP_INCN)
+        {
+            result = (laneLoad<Vector>(destination) + instruction.src) & 0xFF;
+            flags = (result == 0) & (FLAG_CF | FLAG_OF | FLAG_ZF);
+        }
+        else
+        {
+            result = (laneLoad<Vector>(destination) - instruction.src) & 0xFF;
+            flags = ((result == 255) & FLAG_UF) | ((result == 0) & FLAG_ZF);
+        }
+        laneWrite(destination, result, mask);
+        laneWrite(&group.flags[offset], flags, mask);
+        break;
+    }
+    case OP_ADDM:
+    {
+        int32_t *target = &group.registers[instruction.aux][offset];
+
+        // Same steps as the LOAD, ADD and STORE it replaces
+        laneWrite(target, laneLoad<Vector>(&group.memory[dst][offset]), mask);
+        laneWriteResult(group, instruction.aux, laneLoad<Vector>(target) + laneOperand<Vector>(group, instruction.srcMode, instruction.src, offset), mask, offset);
+        laneWrite(&group.memory[dst][offset], laneLoad<Vector>(target), mask);
+        break;
+    }
+    default:
+        // Block instructions never reach the lanes, lanesSupported turns their programs away
+        break;
+    }
+
+    // Lanes that ran a non-jump instruction go on to the next one
+    laneStore(&group.pc[offset], laneLoad<Vector>(&group.pc[offset]) - mask);
+}
+
+// Kernel steps between two folds of the 32-bit lane counters, a lane counts at most one instruction per step
+const uint32_t LANE_COUNTER_FOLD = 1u << 30;
+
+// Function to add the 32-bit lane counters to the 64-bit totals and clear them
+inline void foldLaneCounters(LaneGroup &group)
+{
+    for (int lane = 0; lane < LANES; lane++)
+    {
+        group.total[lane] += group.counter[lane];
+        group.counter[lane] = 0;
+    }
+}
+
+// Function to run every lane of a group until all of them halted
+// Lanes whose program counter is the lowest one execute together, so diverged lanes join again at the same instruction
+template <class Vector>
+LANE_INLINE void runLaneKernel(LaneGroup &group, const Program &program)
+{
+    const int width = sizeof(Vector) / sizeof(int32_t);
+    int size = (int)program.code.size();
+    int pc = *min_element(group.pc, group.pc + LANES);
+    uint32_t steps = 0;
+
+    while (pc < size)
+    {
+        if (++steps == LANE_COUNTER_FOLD)
+        {
+            foldLaneCounters(group);
+            steps = 0;
+        }
+
+        const Instruction &instruction = program.code[pc];
+        for (int offset = 0; offset < LANES; offset += width)
+            laneExecute<Vector>(group, instruction, pc, offset);
+
+        // Every other lane is already past a non-jump instruction, so the next one is the lowest again
+        if (instruction.opcode >= OP_JMP && instruction.opcode <= OP_JC)
+            pc = *min_element(group.pc, group.pc + LANES);
+        else
+            pc++;
+    }
+    foldLaneCounters(group);
+}
+
+#if defined(__x86_64__)
+// The kernel compiled for AVX2 and eight lanes per vector, chosen at runtime when the host has it
+__attribute__((target("avx2"))) void runLaneGroupAvx2(LaneGroup &group, const Program &program)
+{
+    runLaneKernel<Vector8>(group, program);
+}
+#endif
+#endif
+
+// Function to run a group of lanes with the widest vector instructions the host supports
+void runLaneGroup(LaneGroup &group, const Program &program)
+{
+#if defined(LANES_SIMD) && defined(__x86_64__)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2)
+    {
+        runLaneGroupAvx2(group, program);
+        return;
+    }
+#endif
+#if defined(LANES_SIMD)
+    runLaneKernel<Vector4>(group, program);
+#else
+    (void)group;
+    (void)program;
+#endif
+}
+
+// Function to check that lanes can run a program
+// Programs are verified when they are loaded, so only the vector types and the opcodes decide
+// Block instructions touch a different range in every lane, those programs and builds without vector types run every input alone
+bool lanesSupported(const Program &program)
+{
+#if defined(LANES_SIMD)
+    for (const Instruction &instruction : program.code)
+        if (instruction.opcode >= OP_MEMSET)
+            return false;
+    return true;
+#else
+    (void)program;
+    return false;
+#endif
+}
+
+// Function to run a program over input vectors first to last in lockstep groups, one result text per input
+void runLaneBatch(const Program &program, const vector<vector<int>> &inputs, size_t first, size_t last, vector<string> &results)
+{
+    auto group = make_unique<LaneGroup>();
+    int size = (int)program.code.size();
+
+    for (size_t start = first; start < last; start += LANES)
+    {
+        int used = (int)min<size_t>(LANES, last - start);
+
+        // Unused lanes of a partial group start halted
+        *group = LaneGroup();
+        for (int lane = 0; lane < LANES; lane++)
+        {
+            group->pc[lane] = lane < used ? 0 : size;
+            if (lane < used)
+                group->input[lane] = InputBuffer(inputs[start + lane]);
+        }
+
+        runLaneGroup(*group, program);
+
+        // Each lane is dumped through a scalar machine, so the text is exactly what a solo run writes
+        for (int lane = 0; lane < used; lane++)
+        {
+            Machine machine;
+            for (int i = 0; i < REGISTER_SIZE; i++)
+                machine.registers[i] = (uint8_t)group->registers[i][lane];
+            for (int i = 0; i < MEMORY_SIZE; i++)
+                machine.memory[i] = (uint8_t)group->memory[i][lane];
+            machine.flags = (uint8_t)group->flags[lane];
+            machine.pc = group->pc[lane];
+            machine.counter = group->total[lane];
+            mapProgramCounter(machine, program);
+
+            ostringstream result;
+            group->output[lane].print(result);
+            printState(result, machine);
+            results[start + lane] = result.str();
+        }
+    }
+}
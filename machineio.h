@@ -0,0 +1,144 @@
+#pragma once
+#include "mappedfile.h"
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <ostream>
+#include <vector>
+
+// Values read by IN, loaded up front from a file, stdin or memory instead of prompting per value
+// The values are borrowed, so many runs can read the same vector at once
+class InputBuffer
+{
+private:
+    const vector<int> *values = nullptr;
+    size_t position = 0;
+
+public:
+    InputBuffer() = default;
+    explicit InputBuffer(const vector<int> &values) : values(&values) {}
+
+    // Method to take the next value, false when the input is used up
+    bool read(int &value)
+    {
+        if (values == nullptr || position == values->size())
+            return false;
+        value = (*values)[position++];
+        return true;
+    }
+
+    // Method to check that a value is waiting to be read
+    bool ready() const { return values != nullptr && position < values->size(); }
+
+    // Method to start reading from the first value again
+    void rewind() { position = 0; }
+};
+
+// Values written by OUT, collected and printed in one go after the run
+class OutputBuffer
+{
+private:
+    vector<int64_t> values;
+
+public:
+    // Method to capture one output value, wide enough for every word width
+    void write(int64_t value) { values.push_back(value); }
+
+    const vector<int64_t> &captured() const { return values; }
+
+    // Method to print the captured values the way OUT prints them to the console
+    void print(ostream &out) const
+    {
+        for (int64_t value : values)
+            out << "Output screen: " << value << '\n';
+    }
+};
+
+// Function to parse whitespace separated numbers, false on anything that is not a number
+bool parseInputValues(string_view text, vector<int> &values)
+{
+    const char *current = text.data();
+    const char *end = text.data() + text.size();
+
+    while (true)
+    {
+        while (current != end && isspace((unsigned char)*current))
+            current++;
+        if (current == end)
+            return true;
+
+        if (*current == '+')
+            current++;
+        int value;
+        auto result = from_chars(current, end, value);
+        if (result.ec != errc() || (result.ptr != end && !isspace((unsigned char)*result.ptr)))
+            return false;
+
+        values.push_back(value);
+        current = result.ptr;
+    }
+}
+
+// Function to read the whole input text of a file, or of stdin for "-"
+bool readInputText(const string &path, string &text)
+{
+    if (path == "-")
+    {
+        text.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+        return true;
+    }
+
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+    text = string(file.text());
+    return true;
+}
+
+// Function to load the values for IN from a file, or from stdin for "-"
+bool loadInput(const string &path, vector<int> &values)
+{
+    string text;
+    if (!readInputText(path, text))
+    {
+        cerr << "Error: Unable to open input values file " << path << endl;
+        return false;
+    }
+    if (!parseInputValues(text, values))
+    {
+        cerr << "Error: Invalid number in input values file " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to load a batch of input vectors, one vector per line
+bool loadInputBatch(const string &path, vector<vector<int>> &batch)
+{
+    string text;
+    if (!readInputText(path, text))
+    {
+        cerr << "Error: Unable to open input batch file " << path << endl;
+        return false;
+    }
+
+    string_view remaining(text);
+    int lineNumber = 0;
+    while (!remaining.empty())
+    {
+        size_t end = remaining.find('\n');
+        string_view line = remaining.substr(0, end);
+        remaining = end == string_view::npos ? string_view() : remaining.substr(end + 1);
+        lineNumber++;
+
+        vector<int> values;
+        if (!parseInputValues(line, values))
+        {
+            cerr << "Error: Invalid number in input batch on line " << lineNumber << endl;
+            return false;
+        }
+        batch.push_back(move(values));
+    }
+    return true;
+}
@@ -1,161 +1,519 @@
-#include "function.h"
+#include "batch.h"
+#include "profiler.h"
+#include "costmodel.h"
+#include "datacache.h"
+#include "trace.h"
+#include "server.h"
+#include <charconv>
+#include <cstring>
 
-// Function to remove commas from a string
-void removeComma(string &command){
-    string line = "";
-    bool insideQuotes = false;
+// Function to print how to run the interpreter
+void printUsage(const char *program){
+    cerr << "Usage: " << program << " [--headless] [--diff [--redraw N]] [--step] [--engine NAME] [--machine BITS] [--cache] [--optimize] [--profile] [--cycles] [--cost-model FILE] [--dcache SPEC [--dcache-l2 SPEC]] [--verify-jit] [--input FILE] [--trace FILE [--trace-compress]] [--snapshot FILE [--snapshot-at N] [--checkpoint N]] [--restore FILE] [input.asm [output.txt]]" << endl;
+    cerr << "       " << program << " --server PATH [--engine NAME] [--machine BITS] [--optimize] [--jobs N] [--quantum N]" << endl;
+    cerr << "       " << program << " --verify-jit-generated N [--optimize]" << endl;
+    cerr << "       " << program << " --render-trace FILE [--headless] [--diff [--redraw N]] [--step] [output.txt]" << endl;
+    cerr << "       " << program << " --input-batch FILE [--lanes] [--restore FILE] [--engine NAME] [--machine BITS] [--optimize] [--jobs N] [input.asm [output.txt]]" << endl;
+    cerr << "       " << program << " --batch [--engine NAME] [--machine BITS] [--cache] [--optimize] [--jobs N] [--output-dir DIR] [--input FILE] file.asm|directory..." << endl;
+    cerr << "  --headless    run without per-instruction display, write only the final state" << endl;
+    cerr << "  --diff        show only the registers, flags and cells each step changed instead of the full tables" << endl;
+    cerr << "  --redraw N    with --diff, draw the full tables every N steps (default: 64, 0 for only on request)" << endl;
+    cerr << "  --step        wait before each instruction: Enter steps, r redraws the tables, c continues, q quits" << endl;
+    cerr << "  --engine      switch (default), threaded or jit for headless and batch runs" << endl;
+    cerr << "  --machine     8 (default: R0-R6, 64 cells), 16 (R0-R7, 4096 cells) or 32 (R0-R9, 65536 cells) bit words" << endl;
+    cerr << "  --cache       reuse assembled objects from .asmcache, keyed by the source content" << endl;
+    cerr << "  --cache-dir   directory of the object cache, implies --cache" << endl;
+    cerr << "  --optimize    fold constants and fuse common instruction sequences before running" << endl;
+    cerr << "  --profile     count executions and time per line, opcode and memory cell into output.txt.profile" << endl;
+    cerr << "  --cycles      count guest cycles and per-opcode counters into output.txt.cycles" << endl;
+    cerr << "  --cost-model  read the cycles per opcode and addressing mode from FILE, implies --cycles" << endl;
+    cerr << "  --dcache      simulate a data cache of SIZE,WAYS,LINE[,lru|fifo|random] cells into output.txt.dcache" << endl;
+    cerr << "  --dcache-l2   add a second cache level behind --dcache" << endl;
+    cerr << "  --verify-jit  run the program compiled and interpreted and compare the final state" << endl;
+    cerr << "  --verify-jit-generated N  compare them on N generated programs instead, optimized with --optimize" << endl;
+    cerr << "  --trace       record every executed instruction as a compact binary trace in FILE" << endl;
+    cerr << "  --trace-compress compress the trace blocks on the writer thread" << endl;
+    cerr << "  --server      serve SUBMIT, RUN, EXEC, START and FEED requests on the Unix socket PATH until stopped" << endl;
+    cerr << "  --quantum N   instructions a server session runs before the next one gets its turn (default: 1000)" << endl;
+    cerr << "  --snapshot    write the machine state to FILE when the run stops" << endl;
+    cerr << "  --snapshot-at N stop after N instructions, with --snapshot" << endl;
+    cerr << "  --checkpoint N also rewrite the snapshot every N instructions" << endl;
+    cerr << "  --restore     start from the state saved in FILE instead of a fresh machine" << endl;
+    cerr << "  --render-trace replay a trace with today's tables, or only the final state with --headless" << endl;
+    cerr << "  --input       read the values for IN from FILE (- for stdin) instead of prompting" << endl;
+    cerr << "  --input-batch run the program once per line of FILE, each line holding the values for IN" << endl;
+    cerr << "  --lanes       run --input-batch in lockstep groups of " << LANES << " inputs with SIMD registers (8-bit machine)" << endl;
+    cerr << "  --batch       run every listed program in parallel, one .out result file each" << endl;
+    cerr << "  --jobs N      number of worker threads for --batch and --input-batch (default: all cores)" << endl;
+    cerr << "  --output-dir  directory for --batch result files, laid out like the scanned directories (default: next to each program)" << endl;
+}
 
-    for (char letter : command){
-        if (letter == '"')
-            insideQuotes = !insideQuotes;
+// Function to parse a whole option value as a number, false for anything else or a value out of range
+template <class Number>
+bool parseOptionNumber(const char *text, Number &value){
+    const char *end = text + strlen(text);
+    auto result = from_chars(text, end, value);
+    return result.ec == errc() && result.ptr == end;
+}
 
-        if (!insideQuotes && letter == ',')
-            line += ' ';
-        else
-            line += letter;
-    }
+// Function to compare the JIT with the interpreter on generated programs, returning the exit code
+// The generator only writes what the JIT supports, so a program it refuses to compile fails the check as well
+int verifyGeneratedJit(int count, bool optimize){
+    for (int seed = 1; seed <= count; seed++){
+        string text = generateJitProgram(seed);
+        Program program = assemble(text);
+        if (optimize)
+            program = optimizeProgram(program);
 
-    command = line;
+        bool compiled;
+        string interpreted, native;
+        if (!verifyJit(program, compiled, interpreted, native) || !compiled){
+            cerr << "JIT: generated program " << seed << (compiled ? " differs from the interpreter" : " was not compiled") << endl;
+            cerr << text;
+            if (compiled)
+                cerr << "Interpreter:" << endl << interpreted << "JIT:" << endl << native;
+            return 1;
+        }
+    }
+    cerr << "JIT: " << count << " generated programs match the interpreter" << endl;
+    return 0;
 }
 
-// Function to split a string into words based on space or comma
-vector<string> splitLine(string line) {
-  vector<string> words;
-  string currentWord;
-
-  // Iterate through each character in the input line
-  for (char c : line) {
-    if (c == ' ' || c == ',') {
-      // Found a space or comma, consider the current word as complete
-      if (!currentWord.empty()) {
-        words.push_back(currentWord);
-        currentWord.clear();  // Reset current word for the next word
-      }
-    } else {
-      // Add the character to the current word
-      currentWord += c;
-    }
-  }
-
-  // If there's a word at the end of the line, add it
-  if (!currentWord.empty()) {
-    words.push_back(currentWord);
-  }
-
-  return words;
-}
+// Function to run a program on a machine of the chosen shape and write its final state, false if the run could not start
+template <class Config>
+bool runSingle(const Program &program, const RunOptions &options, const DisplayOptions &displayOptions, bool headless, bool useInput, Profiler *profiler, CycleCounter *cycles, CacheSimulator *caches, TraceWriter *trace, SnapshotSchedule *snapshots, const string &outputPath){
+    auto owner = startMachine<Config>(options);
+    BasicMachine<Config> &machine = *owner;
+
+    // Snapshot points count from where a restored run starts
+    if (snapshots)
+        snapshots->start(machine.counter);
+
+    // IN reads the loaded values when they were given, headless runs print OUT values once at the end
+    InputBuffer input(options.input);
+    OutputBuffer captured;
+    if (useInput)
+        machine.input = &input;
+    if (headless)
+        machine.output = &captured;
 
-void printRegisters(ostream &output, string registers[]){
-    output << "Registers: ";
+    // The profiler only knows the default machine
+    constexpr bool profiled = is_same_v<Config, DefaultConfig>;
 
-    for (int i = 0; i < REGISTER_SIZE; i++){
-        try{
-            int r0 = stoi(registers[i]);
-            if (r0 == 0 && i != REGISTER_SIZE - 1){
-                output << setw(4) << setfill('0') << r0 << " ";
+    // Without its header there is no trace to append records to
+    if (trace && !trace->start(machine, program)){
+        cerr << "Error: Unable to write trace file." << endl;
+        return false;
+    }
+
+    // Profiling, cycle counting, cache simulation and tracing wrap each step, so they always use the stepping interpreter
+    BasicOperations<Config> operations(machine);
+    auto stepOnce = [&](){
+        if (trace)
+            trace->before(machine, program);
+        if (cycles)
+            cycles->charge(machine);
+        if (caches)
+            caches->record(program, machine);
+
+        bool stepped = false;
+        if constexpr (profiled){
+            if (profiler){
+                profiler->step(operations, machine);
+                stepped = true;
             }
-            else{
-                output << r0 << " ";
+        }
+        if (!stepped)
+            step(operations, machine, program);
+
+        if (trace)
+            trace->after(machine, program);
+    };
+
+    if (headless){
+        // Headless runs skip the per-instruction display entirely
+        if (profiler || cycles || caches || trace){
+            while (machine.pc < (int)program.code.size()){
+                stepOnce();
+                if (snapshots && snapshots->reached(machine, program))
+                    break;
             }
-            registers[i] = to_string(r0);
         }
-        catch (const invalid_argument &){
-            output << registers[i] << setw(4) << setfill('0') << "0";
-            registers[i] = "0";
+        else if (snapshots){
+            // Runs that save their state go from one snapshot point to the next
+            do
+                runUntil(machine, program, snapshots->limit());
+            while (machine.pc < (int)program.code.size() && !snapshots->reached(machine, program));
         }
+        else
+            runWithEngine(options.engine, machine, program);
+
+        ostringstream screen;
+        captured.print(screen);
+        cout << screen.str();
     }
+    else{
+        StateDisplay<Config> display(displayOptions);
 
-    output << "#\n";
-}
+        // Execute decoded instructions until control runs past the end or the user quits
+        while (machine.pc < (int)program.code.size()){
+            cout << program.source[machine.pc] << endl;
+            if (!display.pause(machine))
+                break;
 
-// Function to print flags and PC
-void printFlagsAndPC(ostream &output){
-    output << "Flags    : 0 0 0 0 #" << endl;
-    output << "PC       : 25" << endl;
+            // A prompted IN leaves the end of its line behind, it must not count as a step command
+            bool prompted = program.code[machine.pc].opcode == OP_IN && !machine.input;
+
+            // Execute the instruction and update the state
+            stepOnce();
+            if (prompted && display.stepping())
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+            // Display the updated state
+            display.show(machine);
+            if (snapshots && snapshots->reached(machine, program))
+                break;
+        }
+    }
+
+    // The snapshot holds the state as executed, before the PC is mapped back
+    if (snapshots)
+        snapshots->save(machine, program);
+
+    // The dump shows the PC of the program as written, even when it was optimized
+    mapProgramCounter(machine, program);
+
+    // Format the final state in memory and write it in one go
+    ostringstream state;
+    printState(state, machine);
+    ofstream output(outputPath);
+    output << state.str();
+    return true;
 }
 
-// Function to print memory
-void printMemory(ostream &output, const vector<int> &memory){
-    vector<int> M(64, 0);
-    for (int i = 0; i < MEMORY_SIZE; i++)
-        M[i] = memory[i];
+int main(int argc, char *argv[]){
+    bool headless = false;
+    bool batch = false;
+    bool profile = false;
+    bool countCycles = false;
+    bool verify = false;
+    int generatedChecks = 0;
+    bool traceCompress = false;
+    RunOptions options;
+    DisplayOptions display;
+    size_t jobs = thread::hardware_concurrency();
+    string outputDirectory;
+    string inputValuesPath;
+    string inputBatchPath;
+    string tracePath;
+    string renderPath;
+    string socketPath;
+    string costModelPath;
+    vector<CacheLevelConfig> cacheLevels(1);
+    bool simulateCache = false;
+    bool secondLevel = false;
+    string snapshotPath;
+    string restorePath;
+    int64_t snapshotAt = 0;
+    int64_t checkpointEvery = 0;
+    vector<string> files;
 
-    output << "Memory:" << endl;
-    for (int i = 0; i < MEMORY_SIZE; i++){
-        if (M[i] == 0 && (i % 8) == 0 && i == 0){
-            output << setw(4) << setfill('0') << M[i] << " ";
+    // Parse the run mode and the input and output file names
+    for (int i = 1; i < argc; i++){
+        string argument = argv[i];
+        if (argument == "--headless")
+            headless = true;
+        else if (argument == "--diff")
+            display.diff = true;
+        else if (argument == "--redraw" && i + 1 < argc && parseOptionNumber(argv[i + 1], display.redrawEvery))
+            i++;
+        else if (argument == "--step")
+            display.stepping = true;
+        else if (argument == "--engine" && i + 1 < argc && parseEngine(argv[i + 1], options.engine))
+            i++;
+        else if (argument == "--machine" && i + 1 < argc && parseMachine(argv[i + 1], options.machine))
+            i++;
+        else if (argument == "--cache")
+            options.cacheDirectory = ".asmcache";
+        else if (argument == "--cache-dir" && i + 1 < argc)
+            options.cacheDirectory = argv[++i];
+        else if (argument == "--optimize")
+            options.optimize = true;
+        else if (argument == "--profile")
+            profile = true;
+        else if (argument == "--cycles")
+            countCycles = true;
+        else if (argument == "--cost-model" && i + 1 < argc){
+            costModelPath = argv[++i];
+            countCycles = true;
+        }
+        else if (argument == "--dcache" && i + 1 < argc && parseCacheLevel(argv[i + 1], cacheLevels[0])){
+            simulateCache = true;
+            i++;
+        }
+        else if (argument == "--dcache-l2" && i + 1 < argc && parseCacheLevel(argv[i + 1], cacheLevels.emplace_back())){
+            secondLevel = true;
+            i++;
         }
-        else if (M[i] == 0 && (i % 8) == 0 && i != 0){
-            output << endl;
-            output << setw(4) << setfill('0') << M[i] << " ";
+        else if (argument == "--verify-jit")
+            verify = true;
+        else if (argument == "--verify-jit-generated" && i + 1 < argc && parseOptionNumber(argv[i + 1], generatedChecks))
+            i++;
+        else if (argument == "--input" && i + 1 < argc)
+            inputValuesPath = argv[++i];
+        else if (argument == "--input-batch" && i + 1 < argc)
+            inputBatchPath = argv[++i];
+        else if (argument == "--trace" && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (argument == "--trace-compress")
+            traceCompress = true;
+        else if (argument == "--server" && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (argument == "--quantum" && i + 1 < argc && parseOptionNumber(argv[i + 1], options.quantum)){
+            options.quantum = max(1, options.quantum);
+            i++;
         }
-        else if (M[i] == 0 && (i % 8) != 0){
-            output << setw(4) << setfill('0') << M[i] << " ";
+        else if (argument == "--snapshot" && i + 1 < argc)
+            snapshotPath = argv[++i];
+        else if (argument == "--snapshot-at" && i + 1 < argc && parseOptionNumber(argv[i + 1], snapshotAt)){
+            snapshotAt = max<int64_t>(0, snapshotAt);
+            i++;
         }
-        else if (M[i] > 0 && (i % 8) != 0){
-            output << setw(4) << setfill(' ') << M[i] << " ";
+        else if (argument == "--checkpoint" && i + 1 < argc && parseOptionNumber(argv[i + 1], checkpointEvery)){
+            checkpointEvery = max<int64_t>(0, checkpointEvery);
+            i++;
+        }
+        else if (argument == "--restore" && i + 1 < argc)
+            restorePath = argv[++i];
+        else if (argument == "--render-trace" && i + 1 < argc)
+            renderPath = argv[++i];
+        else if (argument == "--lanes")
+            options.lanes = true;
+        else if (argument == "--batch")
+            batch = true;
+        else if (argument == "--jobs" && i + 1 < argc && parseOptionNumber(argv[i + 1], jobs))
+            i++;
+        else if (argument == "--output-dir" && i + 1 < argc)
+            outputDirectory = argv[++i];
+        else if (argument[0] != '-')
+            files.push_back(argument);
+        else{
+            // Unknown options and options with a missing or malformed value end up here
+            cerr << "Error: Invalid option " << argument << endl;
+            printUsage(argv[0]);
+            return 1;
         }
     }
 
-    output << endl
-           << "#\n";
-}
+    // A trace carries its own program, rendering it runs nothing
+    if (!renderPath.empty()){
+        TraceReader reader;
+        MachineModel model;
+        if (!reader.open(renderPath) || !parseMachine(to_string(reader.wordBits), model)){
+            cerr << "Error: Unable to read trace file." << endl;
+            return 1;
+        }
+        string outputPath = files.size() > 0 ? files[0] : "fileOutput2.txt";
+        bool rendered = withMachineConfig(model, [&](auto config){
+            return renderTrace<decltype(config)>(reader, headless, display, outputPath);
+        });
+        if (!rendered){
+            cerr << "Error: Trace file is damaged or does not match its machine." << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Generated programs need no input file and always run on the 8-bit machine
+    if (generatedChecks > 0)
+        return verifyGeneratedJit(generatedChecks, options.optimize);
+
+    if ((batch || !inputBatchPath.empty()) && !tracePath.empty()){
+        cerr << "Error: --trace records single runs only." << endl;
+        return 1;
+    }
 
-int main(){
-    // Initialize registers and memory
-    for (int count = 0; count < REGISTER_SIZE; count++)
-        registers[count] = " ";
+    if ((batch || !inputBatchPath.empty() || !socketPath.empty()) && countCycles){
+        cerr << "Error: --cycles and --cost-model count single runs only." << endl;
+        return 1;
+    }
+
+    if ((batch || !inputBatchPath.empty() || !socketPath.empty()) && simulateCache){
+        cerr << "Error: --dcache simulates single runs only." << endl;
+        return 1;
+    }
+
+    if (secondLevel && (!simulateCache || cacheLevels.size() > 2)){
+        cerr << "Error: --dcache-l2 needs one --dcache and is given once." << endl;
+        return 1;
+    }
 
-    ifstream input;
+    if ((batch || !inputBatchPath.empty()) && !snapshotPath.empty()){
+        cerr << "Error: --snapshot records single runs only." << endl;
+        return 1;
+    }
 
-    string line;
+    if ((batch || !socketPath.empty()) && !restorePath.empty()){
+        cerr << "Error: --restore needs a single program." << endl;
+        return 1;
+    }
 
-    // Open input and output files
-     input.open("filleInput4.asm");
-    if (!input.is_open()){
+    if (snapshotPath.empty() && (snapshotAt > 0 || checkpointEvery > 0)){
+        cerr << "Error: --snapshot-at and --checkpoint need --snapshot." << endl;
+        return 1;
+    }
+
+    if ((batch || !socketPath.empty()) && options.machine != MACHINE_8 && options.optimize){
+        cerr << "Error: --optimize needs --machine 8." << endl;
+        return 1;
+    }
+
+    // Values for IN are loaded in bulk before anything runs
+    if (!inputValuesPath.empty() && !loadInput(inputValuesPath, options.input))
+        return 1;
+
+    if (!socketPath.empty())
+        return runServer(socketPath, jobs, options);
+
+    if (batch)
+        return runBatch(files, outputDirectory, jobs, options);
+
+    if (files.size() > 2){
+        printUsage(argv[0]);
+        return 1;
+    }
+    string inputPath = files.size() > 0 ? files[0] : "filleInput4.asm";
+    string outputPath = files.size() > 1 ? files[1] : "fileOutput2.txt";
+
+    Program program;
+
+    // Map and decode the whole input file once, or load its cached object
+    if (!loadProgram(inputPath, program, options.cacheDirectory, registerCount(options.machine))){
         cerr << "Error: Unable to open input file." << endl;
         return 1; // Return an error code
     }
-    output.open("fileOutput2.txt");
-
 
+    // Every operand is checked once here, so the interpreters never check them while running
+    if (!verifyProgram(program, options.machine)){
+        cerr << "Error: Program rejected by the verifier." << endl;
+        return 1;
+    }
 
-    // Process each line in the input file
-    while (getline(input, line)){
-        // Clean up commas in the line
-        removeComma(line);
-        // Split the line into individual words (commands)
-        vector<string> command = splitLine(line);
+    // The optimizer, the profiler and the JIT check are written for the 8-bit machine
+    if (options.machine != MACHINE_8 && (options.optimize || profile || verify)){
+        cerr << "Error: --optimize, --profile and --verify-jit need --machine 8." << endl;
+        return 1;
+    }
 
-        if (!command.empty()){
-            cout << line << endl;
+    // Cycles are counted on the instructions the optimizer replaced, so they are kept aside
+    Program source = program;
+    if (options.optimize)
+        program = optimizeProgram(program);
 
-            // Execute the command and update the state
-            execute(command);
+    // The saved state is loaded once, every run forks its own machine from it
+    if (!restorePath.empty()){
+        bool restored = withMachineConfig(options.machine, [&](auto config){
+            using Config = decltype(config);
+            auto machine = make_unique<BasicMachine<Config>>();
+            if (!readSnapshot(restorePath, program, *machine))
+                return false;
+            options.snapshot = make_shared<Snapshot>(*machine);
+            return true;
+        });
+        if (!restored)
+            return 1;
+    }
 
-            // Display the updated state
-            displayRegisters();
-            displayFlags();
-            displayMemory();
+    // One program over many input vectors, every run gets its own machine
+    if (!inputBatchPath.empty()){
+        vector<vector<int>> inputs;
+        if (!loadInputBatch(inputBatchPath, inputs))
+            return 1;
+        return runInputBatch(program, inputs, outputPath, jobs, options);
+    }
 
-            // Reset flags after display
-            for (int i = 0; i < FLAGS_SIZE; i++)
-                flags[i] = 0;
+    // Differential check of the native code generator against the interpreter
+    if (verify){
+        bool compiled;
+        string interpreted, native;
+        bool match = verifyJit(program, compiled, interpreted, native);
 
-            cout << endl;
+        if (!compiled)
+            cerr << "JIT: program not compiled, interpreter used for both runs" << endl;
+        if (!match){
+            cerr << "JIT: final state differs from the interpreter" << endl;
+            cerr << "Interpreter:" << endl << interpreted << "JIT:" << endl << native;
+            return 1;
         }
-        else{
-            cerr << "Error: Invalid command on line " << counter << endl;
+        cerr << "JIT: final state matches the interpreter" << endl;
+        return 0;
+    }
+
+    // Profiling wraps each step, runs without it use the plain loop
+    unique_ptr<Profiler> profiler;
+    if (profile)
+        profiler = make_unique<Profiler>(program);
+
+    // Costs are fixed per instruction once the model is read, the run only adds them up
+    unique_ptr<CycleCounter> cycles;
+    if (countCycles){
+        CostModel model;
+        if (!costModelPath.empty() && !model.load(costModelPath))
+            return 1;
+        cycles = make_unique<CycleCounter>(program, source, model);
+    }
+
+    // Every cell of the machine gets its own miss counter
+    unique_ptr<CacheSimulator> caches;
+    if (simulateCache){
+        int memorySize = withMachineConfig(options.machine, [](auto config){
+            return decltype(config)::MEMORY;
+        });
+        caches = make_unique<CacheSimulator>(cacheLevels, memorySize);
+    }
+
+    // Trace records are written by a background thread while the program runs
+    unique_ptr<TraceWriter> trace;
+    if (!tracePath.empty()){
+        trace = make_unique<TraceWriter>();
+        if (!trace->open(tracePath, traceCompress)){
+            cerr << "Error: Unable to create trace file." << endl;
+            return 1;
         }
     }
 
-    printRegisters(output, registers);
-    printFlagsAndPC(output);
-    printMemory(output, vector<int>(memory, memory + MEMORY_SIZE));
+    unique_ptr<SnapshotSchedule> snapshots;
+    if (!snapshotPath.empty())
+        snapshots = make_unique<SnapshotSchedule>(snapshotPath, snapshotAt, checkpointEvery);
 
+    bool ran = withMachineConfig(options.machine, [&](auto config){
+        return runSingle<decltype(config)>(program, options, display, headless, !inputValuesPath.empty(), profiler.get(), cycles.get(), caches.get(), trace.get(), snapshots.get(), outputPath);
+    });
+    if (!ran)
+        return 1;
 
-    // Close input and output files
-    input.close();
-    output.close();
+    if (snapshots && !snapshots->good()){
+        cerr << "Error: Unable to write snapshot file." << endl;
+        return 1;
+    }
+
+    if (trace && !trace->close()){
+        cerr << "Error: Unable to write trace file." << endl;
+        return 1;
+    }
+
+    // The hotspot report goes next to the final state dump
+    if (profiler){
+        ofstream report(outputPath + ".profile");
+        profiler->writeReport(report);
+    }
+    if (cycles){
+        ofstream report(outputPath + ".cycles");
+        cycles->writeReport(report);
+    }
+    if (caches){
+        ofstream report(outputPath + ".dcache");
+        caches->writeReport(report);
+    }
     return 0;
 }
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+private:
+    const char *data = nullptr;
+    size_t size = 0;
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    // Method to map a file, false if it cannot be opened
+    bool open(const string &path);
+
+    // Method to view the mapped bytes as text
+    string_view text() const { return string_view(data, size); }
+};
+
+MappedFile::~MappedFile()
+{
+    if (data != nullptr)
+        munmap((void *)data, size);
+}
+
+bool MappedFile::open(const string &path)
+{
+    int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return false;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0)
+    {
+        close(descriptor);
+        return false;
+    }
+
+    size = status.st_size;
+
+    // An empty file has nothing to map but is still a valid source
+    if (size > 0)
+    {
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping == MAP_FAILED)
+        {
+            close(descriptor);
+            size = 0;
+            return false;
+        }
+
+        // Source is read front to back exactly once
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        data = (const char *)mapping;
+    }
+
+    close(descriptor);
+    return true;
+}
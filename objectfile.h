@@ -0,0 +1,170 @@
+#pragma once
+#include "assembler.h"
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
+#include <thread>
+
+// Object files are raw instruction arrays, so the layout must stay plain
+static_assert(is_trivially_copyable<Instruction>::value, "instructions are written to disk as bytes");
+
+// Version of the object format, bump whenever Instruction or the layout changes
+const uint32_t OBJECT_VERSION = 1;
+
+// Header at the start of every object file
+struct ObjectHeader
+{
+    char magic[4];             // "ASMO"
+    uint32_t version;          // OBJECT_VERSION
+    uint64_t sourceHash;       // Content hash of the source the object was built from
+    uint32_t instructionCount; // Number of decoded instructions
+    uint32_t instructionSize;  // sizeof(Instruction) of the writer
+};
+
+// Position of one instruction's text in the source, the source-line map
+struct SourceLine
+{
+    int32_t line;
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Function to hash source text with 64-bit FNV-1a
+uint64_t hashSource(string_view text)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (char letter : text)
+    {
+        hash ^= (uint8_t)letter;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Function to get a private name next to a file, unique across processes and their threads
+string temporaryPath(const string &path)
+{
+    return path + ".tmp" + to_string(getpid()) + "-" + to_string(hash<thread::id>()(this_thread::get_id()));
+}
+
+// Function to move a written temporary file over its target, the temporary is removed when anything failed
+bool replaceFile(const string &temporary, const string &path, bool written)
+{
+    error_code error;
+    if (written)
+        filesystem::rename(temporary, path, error);
+    if (!written || error)
+    {
+        filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+// Function to write a decoded program as an object file
+bool writeObject(const string &path, const Program &program, uint64_t sourceHash, string_view sourceText)
+{
+    ObjectHeader header = {{'A', 'S', 'M', 'O'}, OBJECT_VERSION, sourceHash,
+                           (uint32_t)program.code.size(), (uint32_t)sizeof(Instruction)};
+
+    // Source text is stored as offsets so the object never copies it
+    vector<SourceLine> lines(program.code.size());
+    for (size_t i = 0; i < program.code.size(); i++)
+        lines[i] = {program.lines[i], (uint32_t)(program.source[i].data() - sourceText.data()),
+                    (uint32_t)program.source[i].size()};
+
+    // Write to a private name first so readers never see a half-written object
+    string temporary = temporaryPath(path);
+    bool written;
+    {
+        ofstream output(temporary, ios::binary);
+        output.write((const char *)&header, sizeof(header));
+        output.write((const char *)program.code.data(), program.code.size() * sizeof(Instruction));
+        output.write((const char *)lines.data(), lines.size() * sizeof(SourceLine));
+        output.close();
+        written = output.good();
+    }
+
+    return replaceFile(temporary, path, written);
+}
+
+// Function to load an object file by mapping it, false if it is missing or stale
+bool loadObject(const string &path, uint64_t sourceHash, string_view sourceText, Program &program)
+{
+    MappedFile object;
+    if (!object.open(path))
+        return false;
+
+    string_view bytes = object.text();
+    if (bytes.size() < sizeof(ObjectHeader))
+        return false;
+
+    ObjectHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (memcmp(header.magic, "ASMO", 4) != 0 || header.version != OBJECT_VERSION ||
+        header.sourceHash != sourceHash || header.instructionSize != sizeof(Instruction))
+        return false;
+
+    size_t count = header.instructionCount;
+    size_t codeBytes = count * sizeof(Instruction);
+    if (bytes.size() != sizeof(ObjectHeader) + codeBytes + count * sizeof(SourceLine))
+        return false;
+
+    // Decoded instructions are copied in bulk, nothing is parsed
+    program.code.resize(count);
+    memcpy(program.code.data(), bytes.data() + sizeof(ObjectHeader), codeBytes);
+
+    const char *lineData = bytes.data() + sizeof(ObjectHeader) + codeBytes;
+    program.source.resize(count);
+    program.lines.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        SourceLine line;
+        memcpy(&line, lineData + i * sizeof(SourceLine), sizeof(line));
+        if ((size_t)line.offset + line.length > sourceText.size())
+            return false;
+
+        program.lines[i] = line.line;
+        program.source[i] = sourceText.substr(line.offset, line.length);
+    }
+
+    return true;
+}
+
+// Function to load a program through the object cache, assembling only on a miss
+bool loadProgram(const string &path, Program &program, const string &cacheDirectory, int registerCount = REGISTER_SIZE)
+{
+    if (cacheDirectory.empty())
+        return assembleFile(path, program, registerCount);
+
+    shared_ptr<MappedFile> file = make_shared<MappedFile>();
+    if (!file->open(path))
+        return false;
+
+    // Objects are keyed by the content of the source, not by its name
+    // Register names decode differently per machine, so other register counts get their own object
+    string_view text = file->text();
+    uint64_t sourceHash = hashSource(text);
+    char name[40];
+    if (registerCount == REGISTER_SIZE)
+        snprintf(name, sizeof(name), "%016llx.asmo", (unsigned long long)sourceHash);
+    else
+        snprintf(name, sizeof(name), "%016llx-r%d.asmo", (unsigned long long)sourceHash, registerCount);
+    string objectPath = (filesystem::path(cacheDirectory) / name).string();
+
+    if (!loadObject(objectPath, sourceHash, text, program))
+    {
+        program = assemble(text, registerCount);
+
+        // Sources with errors are assembled again each time so the errors are still reported
+        if (program.errors == 0)
+        {
+            error_code error;
+            filesystem::create_directories(cacheDirectory, error);
+            writeObject(objectPath, program, sourceHash, text);
+        }
+    }
+
+    program.sourceFile = file;
+    return true;
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include "function.h"
+#include <climits>
+
+// Function to clamp a value to a word exactly like updateFlags does
+int clampWord(int value)
+{
+    if (value > 255)
+        return 0;
+    if (value < 0)
+        return 255;
+    return value;
+}
+
+// Function to fold one instruction into a known register value
+// Returns false when the instruction is not a foldable operation on that register
+bool foldInstruction(const Instruction &instruction, int registerIndex, int value, int &raw)
+{
+    if (instruction.dstMode != MODE_REGISTER || instruction.dst != registerIndex)
+        return false;
+
+    int64_t result;
+    int64_t constant = instruction.src;
+    bool immediate = instruction.srcMode == MODE_IMMEDIATE;
+
+    switch (instruction.opcode)
+    {
+    case OP_MOV:
+        if (!immediate)
+            return false;
+        result = constant;
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+        if (!immediate)
+            return false;
+        if (instruction.opcode == OP_ADD)
+            result = value + constant;
+        else if (instruction.opcode == OP_SUB)
+            result = value - constant;
+        else if (instruction.opcode == OP_MUL)
+            result = value * constant;
+        else
+            result = constant != 0 ? value / constant : value;
+        break;
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+        if (!immediate)
+            return false;
+        if (instruction.opcode == OP_AND)
+            result = value & (constant & 0xFF);
+        else if (instruction.opcode == OP_OR)
+            result = value | (constant & 0xFF);
+        else
+            result = value ^ (constant & 0xFF);
+        break;
+    case OP_INC:
+        result = value + 1;
+        break;
+    case OP_DEC:
+        result = value - 1;
+        break;
+    case OP_NOT:
+        result = ~value & 0xFF;
+        break;
+    default:
+        return false;
+    }
+
+    // The interpreter computes in int, results it cannot hold are left alone
+    if (result < INT_MIN || result > INT_MAX)
+        return false;
+
+    raw = (int)result;
+    return true;
+}
+
+// Function to optimize a verified program without changing its final state
+// Constant-folds MOV with the operations after it, merges INC/DEC runs and fuses LOAD/ADD/STORE
+Program optimizeProgram(const Program &program)
+{
+    const vector<Instruction> &code = program.code;
+    size_t size = code.size();
+
+    // Instructions that are jump targets must stay the first of whatever replaces them
+    vector<bool> target(size + 1, false);
+    for (const Instruction &instruction : code)
+        if (instruction.dstMode == MODE_TARGET)
+            target[instruction.dst] = true;
+
+    Program optimized;
+    optimized.sourceFile = program.sourceFile;
+    optimized.errors = program.errors;
+    vector<int32_t> newIndex(size + 1, 0);
+
+    size_t i = 0;
+    while (i < size)
+    {
+        Instruction instruction = code[i];
+        size_t next = i + 1;
+
+        // MOV constant followed by constant operations on the same register becomes one MOV
+        if (instruction.opcode == OP_MOV && instruction.srcMode == MODE_IMMEDIATE)
+        {
+            int raw = instruction.src;
+            while (next < size && !target[next] && foldInstruction(code[next], instruction.dst, clampWord(raw), raw))
+                next++;
+
+            // MOV of the last raw result sets the same value and flags as the last operation
+            instruction.src = raw;
+        }
+        // A run of the same INC or DEC becomes one wrap-around add
+        else if (instruction.opcode == OP_INC || instruction.opcode == OP_DEC)
+        {
+            while (next < size && !target[next] && code[next].opcode == instruction.opcode && code[next].dst == instruction.dst)
+                next++;
+
+            if (next - i > 1)
+            {
+                instruction.opcode = instruction.opcode == OP_INC ? OP_INCN : OP_DECN;
+                instruction.srcMode = MODE_IMMEDIATE;
+                instruction.src = (int32_t)(next - i);
+            }
+        }
+        // LOAD R, a / ADD x, R / STORE R, a on one direct address becomes one memory add
+        else if (instruction.opcode == OP_LOAD && instruction.srcMode == MODE_DIRECT &&
+                 i + 2 < size && !target[i + 1] && !target[i + 2])
+        {
+            const Instruction &add = code[i + 1];
+            const Instruction &store = code[i + 2];
+
+            if (add.opcode == OP_ADD && add.dst == instruction.dst &&
+                store.opcode == OP_STORE && store.src == instruction.dst &&
+                store.dstMode == MODE_DIRECT && store.dst == instruction.src)
+            {
+                instruction = Instruction{OP_ADDM, add.srcMode, MODE_DIRECT, (uint8_t)instruction.dst, add.src, store.dst};
+                next = i + 3;
+            }
+        }
+
+        // Every replaced instruction maps to the one that replaces it
+        for (size_t j = i; j < next; j++)
+            newIndex[j] = (int32_t)optimized.code.size();
+
+        optimized.code.push_back(instruction);
+        optimized.source.push_back(program.source[i]);
+        optimized.lines.push_back(program.lines[i]);
+        optimized.originalIndex.push_back((int32_t)i);
+        i = next;
+    }
+    newIndex[size] = (int32_t)optimized.code.size();
+    optimized.originalIndex.push_back((int32_t)size);
+
+    // Jump targets move with the instructions they point to
+    for (Instruction &instruction : optimized.code)
+        if (instruction.dstMode == MODE_TARGET)
+            instruction.dst = newIndex[instruction.dst];
+
+    return optimized;
+}
+
+// Function to report the program counter as an index of the unoptimized program
+template <class Config>
+void mapProgramCounter(BasicMachine<Config> &machine, const Program &program)
+{
+    if (!program.originalIndex.empty())
+        machine.pc = program.originalIndex[machine.pc];
+}
@@ -0,0 +1,214 @@
+#pragma once
+#include "assembler.h"
+#include <chrono>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Function to read a cheap monotonic tick counter
+inline uint64_t readTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Cells an instruction touches, count cells starting at address
+struct MemoryRange
+{
+    uint32_t address = 0;
+    uint32_t count = 0;
+};
+
+// Memory an instruction reads and writes, block instructions read up to two ranges
+struct MemoryAccess
+{
+    MemoryRange reads[2];
+    MemoryRange write;
+};
+
+// Function to find the cells an instruction will write, the only memory a trace has to record
+template <class Config>
+inline MemoryRange memoryWrite(const Instruction &instruction, const BasicMachine<Config> &machine)
+{
+    if (instruction.opcode == OP_STORE)
+        return {operandAddress(machine, instruction.dstMode, instruction.dst), 1};
+    if (instruction.opcode == OP_ADDM)
+        return {(uint32_t)instruction.dst, 1};
+    if (instruction.opcode == OP_MEMSET || instruction.opcode == OP_MEMCPY || instruction.opcode == OP_VADD || instruction.opcode == OP_VXOR)
+        return {operandAddress(machine, instruction.dstMode, instruction.dst), blockCount(machine, instruction)};
+    return {};
+}
+
+// Function to find the cells an instruction will read and write
+// Addresses are taken before execution, while the registers still hold them, verified programs only reach cells inside memory
+template <class Config>
+MemoryAccess memoryAccess(const Instruction &instruction, const BasicMachine<Config> &machine)
+{
+    MemoryAccess access;
+    access.write = memoryWrite(instruction, machine);
+
+    switch (instruction.opcode)
+    {
+    case OP_MOV:
+        if (instruction.srcMode == MODE_INDIRECT)
+            access.reads[0] = {operandAddress(machine, instruction.srcMode, instruction.src), 1};
+        break;
+    case OP_LOAD:
+        access.reads[0] = {operandAddress(machine, instruction.srcMode, instruction.src), 1};
+        break;
+    case OP_ADDM:
+        access.reads[0] = access.write;
+        break;
+    case OP_MEMCPY:
+    case OP_MEMCMP:
+    case OP_VADD:
+    case OP_VXOR:
+    case OP_VSUM:
+    {
+        // MEMCMP may stop at the first difference, its whole ranges count as read
+        uint32_t count = blockCount(machine, instruction);
+        access.reads[0] = {operandAddress(machine, instruction.srcMode, instruction.src), count};
+        if (instruction.opcode == OP_MEMCMP || instruction.opcode == OP_VADD || instruction.opcode == OP_VXOR)
+            access.reads[1] = {operandAddress(machine, instruction.dstMode, instruction.dst), count};
+        break;
+    }
+    default:
+        break;
+    }
+    return access;
+}
+
+// Execution counts and host time recorded while a program runs
+class Profiler
+{
+private:
+    const Program &program;
+
+    vector<uint64_t> instructionCounts; // Executions of each decoded instruction
+    vector<uint64_t> instructionTicks;  // Ticks spent in each decoded instruction
+    uint64_t opcodeCounts[OPCODE_COUNT] = {};
+    uint64_t opcodeTicks[OPCODE_COUNT] = {};
+    uint64_t memoryReads[MEMORY_SIZE] = {};
+    uint64_t memoryWrites[MEMORY_SIZE] = {};
+
+    // Tick counter and wall clock at the start, to turn ticks into nanoseconds
+    uint64_t startTicks;
+    chrono::steady_clock::time_point startTime;
+
+public:
+    explicit Profiler(const Program &program);
+
+    // Method to execute one instruction and record its cost
+    void step(Operations &commands, Machine &machine);
+
+    // Method to write the sorted hotspot report
+    void writeReport(ostream &output) const;
+};
+
+Profiler::Profiler(const Program &program)
+    : program(program),
+      instructionCounts(program.code.size(), 0),
+      instructionTicks(program.code.size(), 0),
+      startTicks(readTicks()),
+      startTime(chrono::steady_clock::now())
+{
+}
+
+void Profiler::step(Operations &commands, Machine &machine)
+{
+    int index = machine.pc;
+    const Instruction &instruction = program.code[index];
+
+    // Addresses are taken before execution, while the registers still hold them
+    MemoryAccess access = memoryAccess(instruction, machine);
+    for (const MemoryRange &read : access.reads)
+        for (uint32_t i = 0; i < read.count; i++)
+            memoryReads[read.address + i]++;
+    for (uint32_t i = 0; i < access.write.count; i++)
+        memoryWrites[access.write.address + i]++;
+
+    uint64_t before = readTicks();
+    ::step(commands, machine, program);
+    uint64_t spent = readTicks() - before;
+
+    instructionCounts[index]++;
+    instructionTicks[index] += spent;
+    opcodeCounts[instruction.opcode]++;
+    opcodeTicks[instruction.opcode] += spent;
+}
+
+void Profiler::writeReport(ostream &output) const
+{
+    // Calibrate the tick counter against the wall clock over the whole run
+    double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - startTime).count();
+    uint64_t ticks = readTicks() - startTicks;
+    double nanosecondsPerTick = ticks > 0 ? elapsed / ticks : 0;
+
+    uint64_t totalCount = 0, totalTicks = 0;
+    for (size_t i = 0; i < instructionCounts.size(); i++)
+    {
+        totalCount += instructionCounts[i];
+        totalTicks += instructionTicks[i];
+    }
+
+    output << "Profile  : " << totalCount << " instructions, "
+           << fixed << setprecision(0) << totalTicks * nanosecondsPerTick << " ns" << endl;
+
+    // Hot source lines, most expensive first
+    vector<size_t> order;
+    for (size_t i = 0; i < instructionCounts.size(); i++)
+        if (instructionCounts[i] > 0)
+            order.push_back(i);
+    sort(order.begin(), order.end(), [this](size_t a, size_t b)
+         { return instructionTicks[a] > instructionTicks[b]; });
+
+    output << endl
+           << "Hot lines:" << endl;
+    output << setfill(' ') << setw(8) << "line" << setw(14) << "count" << setw(14) << "ns" << setw(8) << "%"
+           << "  source" << endl;
+    for (size_t i : order)
+    {
+        output << setw(8) << program.lines[i]
+               << setw(14) << instructionCounts[i]
+               << setw(14) << setprecision(0) << instructionTicks[i] * nanosecondsPerTick
+               << setw(8) << setprecision(1) << (totalTicks ? 100.0 * instructionTicks[i] / totalTicks : 0)
+               << "  " << program.source[i] << endl;
+    }
+
+    // Opcodes, most expensive first
+    vector<int> opcodes;
+    for (int opcode = 0; opcode < OPCODE_COUNT; opcode++)
+        if (opcodeCounts[opcode] > 0)
+            opcodes.push_back(opcode);
+    sort(opcodes.begin(), opcodes.end(), [this](int a, int b)
+         { return opcodeTicks[a] > opcodeTicks[b]; });
+
+    output << endl
+           << "Opcodes:" << endl;
+    output << setw(8) << "opcode" << setw(14) << "count" << setw(14) << "ns" << setw(10) << "ns/op" << endl;
+    for (int opcode : opcodes)
+    {
+        output << setw(8) << opcodeName((Opcode)opcode)
+               << setw(14) << opcodeCounts[opcode]
+               << setw(14) << setprecision(0) << opcodeTicks[opcode] * nanosecondsPerTick
+               << setw(10) << setprecision(2) << opcodeTicks[opcode] * nanosecondsPerTick / opcodeCounts[opcode] << endl;
+    }
+
+    // Memory cells, most accessed first
+    vector<int> addresses;
+    for (int address = 0; address < MEMORY_SIZE; address++)
+        if (memoryReads[address] + memoryWrites[address] > 0)
+            addresses.push_back(address);
+    sort(addresses.begin(), addresses.end(), [this](int a, int b)
+         { return memoryReads[a] + memoryWrites[a] > memoryReads[b] + memoryWrites[b]; });
+
+    output << endl
+           << "Memory:" << endl;
+    output << setw(8) << "address" << setw(14) << "reads" << setw(14) << "writes" << endl;
+    for (int address : addresses)
+        output << setw(8) << address << setw(14) << memoryReads[address] << setw(14) << memoryWrites[address] << endl;
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include "function.h"
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+// Where a guest of the scheduler stands
+enum GuestState
+{
+    GUEST_READY,   // Runs in the next slice
+    GUEST_WAITING, // Stopped at an IN with no input left, resumes when input is fed
+    GUEST_HALTED   // Ran past its last instruction
+};
+
+// One lightweight machine hosted by the scheduler
+// Its state is the whole continuation, a suspended guest resumes at its program counter
+template <class Config>
+struct Guest
+{
+    BasicMachine<Config> machine;
+    shared_ptr<const Program> program;
+    vector<int> values; // Input fed so far, read through input
+    InputBuffer input{values};
+    OutputBuffer output;
+    GuestState state = GUEST_READY;
+
+    Guest() = default;
+    Guest(const Guest &) = delete;
+    Guest &operator=(const Guest &) = delete;
+};
+
+// Cooperative round-robin scheduler of many guests on the calling thread
+// Every ready guest runs a quantum of instructions per slice, waiting guests cost nothing until input arrives
+template <class Config>
+class Scheduler
+{
+private:
+    unordered_map<uint64_t, unique_ptr<Guest<Config>>> guests;
+    deque<uint64_t> ready; // Ids of the ready guests in turn order, removed guests are skipped
+    uint64_t nextId = 1;
+    int quantum;
+
+    // Method to run a guest until it used its quantum, halts or needs input that is not there
+    GuestState runQuantum(Guest<Config> &guest);
+
+public:
+    explicit Scheduler(int quantum) : quantum(quantum) {}
+
+    // Method to add a guest at the first instruction of a program, returning its id
+    uint64_t spawn(shared_ptr<const Program> program, const vector<int> &values);
+
+    // Method to give a guest more input, a guest waiting for it becomes ready, false for an unknown id
+    bool feed(uint64_t id, const vector<int> &values);
+
+    // Method to drop a guest in any state
+    void remove(uint64_t id) { guests.erase(id); }
+
+    // Method to find a guest, null for an unknown id
+    Guest<Config> *find(uint64_t id);
+
+    // Method to give every ready guest one quantum, the ids of guests that halted or started waiting go to changed
+    void runSlice(vector<uint64_t> &changed);
+
+    bool idle() const { return ready.empty(); }
+};
+
+template <class Config>
+GuestState Scheduler<Config>::runQuantum(Guest<Config> &guest)
+{
+    BasicOperations<Config> operations(guest.machine);
+    const Program &program = *guest.program;
+    int size = (int)program.code.size();
+
+    for (int executed = 0; executed < quantum; executed++)
+    {
+        if (guest.machine.pc >= size)
+            return GUEST_HALTED;
+
+        // The guest stops before the IN, so the instruction runs once its input is there
+        if (program.code[guest.machine.pc].opcode == OP_IN && !guest.input.ready())
+            return GUEST_WAITING;
+
+        step(operations, guest.machine, program);
+    }
+    return guest.machine.pc >= size ? GUEST_HALTED : GUEST_READY;
+}
+
+template <class Config>
+uint64_t Scheduler<Config>::spawn(shared_ptr<const Program> program, const vector<int> &values)
+{
+    auto guest = make_unique<Guest<Config>>();
+    guest->program = move(program);
+    guest->values = values;
+    guest->machine.input = &guest->input;
+    guest->machine.output = &guest->output;
+
+    uint64_t id = nextId++;
+    guests.emplace(id, move(guest));
+    ready.push_back(id);
+    return id;
+}
+
+template <class Config>
+bool Scheduler<Config>::feed(uint64_t id, const vector<int> &values)
+{
+    Guest<Config> *guest = find(id);
+    if (!guest)
+        return false;
+
+    // Values already read are dropped, so a long session keeps only what it has not read yet
+    if (!guest->input.ready())
+    {
+        guest->values.clear();
+        guest->input.rewind();
+    }
+    guest->values.insert(guest->values.end(), values.begin(), values.end());
+
+    if (guest->state == GUEST_WAITING && guest->input.ready())
+    {
+        guest->state = GUEST_READY;
+        ready.push_back(id);
+    }
+    return true;
+}
+
+template <class Config>
+Guest<Config> *Scheduler<Config>::find(uint64_t id)
+{
+    auto found = guests.find(id);
+    return found == guests.end() ? nullptr : found->second.get();
+}
+
+template <class Config>
+void Scheduler<Config>::runSlice(vector<uint64_t> &changed)
+{
+    // Guests that stay ready go to the back, after every guest that was ready when the slice began
+    for (size_t turns = ready.size(); turns > 0; turns--)
+    {
+        uint64_t id = ready.front();
+        ready.pop_front();
+
+        Guest<Config> *guest = find(id);
+        if (!guest)
+            continue;
+
+        guest->state = runQuantum(*guest);
+        if (guest->state == GUEST_READY)
+            ready.push_back(id);
+        else
+            changed.push_back(id);
+    }
+}
@@ -0,0 +1,521 @@
+#pragma once
+#include "batch.h"
+#include "scheduler.h"
+#include <csignal>
+#include <cerrno>
+#include <charconv>
+#include <list>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Line-based protocol of the interpreter server, requests can be pipelined on one connection:
+//   SUBMIT <id> <length>\n<program text>      -> OK <id> <handle>\n
+//   RUN <id> <handle> [values for IN...]\n    -> RESULT <id> <length>\n<output and final state>
+//   EXEC <id> <length> [values for IN...]\n<program text>  -> RESULT <id> <length>\n<...>
+//   START <id> <handle> [values for IN...]\n  -> OK <id> <session>\n, RESULT <id> <length>\n<...> once it halts
+//   FEED <id> <session> [values for IN...]\n  -> no reply, the session continues
+//   anything that fails                       -> ERROR <id> <message>\n
+// Programs are assembled in request order, runs finish in any order, the id tells the replies apart.
+// A session is a run that lives on: at an IN with no value left it sends INPUT <id> <session>\n and waits
+// for a FEED from its connection instead of reading 0. Sessions share one thread and end with their connection.
+// The result text is what --batch writes: OUT values, then printRegisters, printFlagsAndPC and printMemory.
+
+// Largest program text a request may carry
+const size_t SERVER_MAX_PROGRAM = 16 << 20;
+
+// Most programs the server keeps assembled, the one used longest ago is dropped to make room
+// A dropped handle fails with "unknown program" until its text is submitted again
+const size_t SERVER_MAX_CACHED = 1024;
+
+// Program assembled by the server, it owns the text its source views point into
+struct ServerProgram
+{
+    string text;
+    Program program;
+    shared_ptr<const JitProgram> native; // Compiled once when runs use the JIT, null when they interpret
+};
+
+// Programs submitted by any connection, keyed by the hash of their text, at most SERVER_MAX_CACHED of them
+// Runs hold their program by shared pointer, so dropping one never pulls it from under a run
+class ProgramCache
+{
+private:
+    using Entry = pair<uint64_t, shared_ptr<const ServerProgram>>;
+
+    mutex lock;
+    list<Entry> recent; // Most recently used first
+    unordered_map<uint64_t, list<Entry>::iterator> programs;
+
+public:
+    // Method to find the program of a handle, null if it was never submitted
+    shared_ptr<const ServerProgram> find(uint64_t handle);
+
+    // Method to assemble text unless it is cached, null with a message if it does not assemble
+    shared_ptr<const ServerProgram> add(string text, const RunOptions &options, uint64_t &handle, string &error);
+};
+
+shared_ptr<const ServerProgram> ProgramCache::find(uint64_t handle)
+{
+    lock_guard<mutex> guard(lock);
+    auto found = programs.find(handle);
+    if (found == programs.end())
+        return nullptr;
+    recent.splice(recent.begin(), recent, found->second);
+    return found->second->second;
+}
+
+shared_ptr<const ServerProgram> ProgramCache::add(string text, const RunOptions &options, uint64_t &handle, string &error)
+{
+    handle = hashSource(text);
+
+    shared_ptr<const ServerProgram> cached = find(handle);
+    if (cached)
+    {
+        if (cached->text == text)
+            return cached;
+        error = "hash collision with another program";
+        return nullptr;
+    }
+
+    // The text is moved into place before assembling, so the source views stay valid
+    auto entry = make_shared<ServerProgram>();
+    entry->text = move(text);
+    entry->program = assemble(entry->text, registerCount(options.machine));
+    if (entry->program.errors > 0)
+    {
+        error = to_string(entry->program.errors) + " lines did not assemble";
+        return nullptr;
+    }
+    if (!verifyProgram(entry->program, options.machine))
+    {
+        error = "program rejected by the verifier";
+        return nullptr;
+    }
+    if (options.optimize)
+        entry->program = optimizeProgram(entry->program);
+    entry->native = prepareNative(entry->program, options);
+
+    // Another connection may have added the same text while this one was assembling
+    lock_guard<mutex> guard(lock);
+    auto found = programs.find(handle);
+    if (found != programs.end())
+        return found->second->second;
+    recent.emplace_front(handle, entry);
+    programs.emplace(handle, recent.begin());
+    if (recent.size() > SERVER_MAX_CACHED)
+    {
+        programs.erase(recent.back().first);
+        recent.pop_back();
+    }
+    return entry;
+}
+
+// One client connection, read by its own thread and written by whichever worker finishes a run
+class ServerConnection
+{
+private:
+    int socket;
+    mutex writeLock;
+    string buffer; // Bytes received but not parsed yet
+    size_t position = 0;
+
+    // Method to receive more bytes, false when the client is gone
+    bool receive();
+
+public:
+    explicit ServerConnection(int socket) : socket(socket) {}
+    ServerConnection(const ServerConnection &) = delete;
+    ServerConnection &operator=(const ServerConnection &) = delete;
+    ~ServerConnection() { close(socket); }
+
+    // Method to read one request line without its newline
+    bool readLine(string &line);
+
+    // Method to read a payload of an exact length
+    bool readBytes(size_t count, string &bytes);
+
+    // Method to send a whole reply, replies of different workers never interleave
+    void send(const string &reply);
+};
+
+bool ServerConnection::receive()
+{
+    // Parsed bytes are dropped before reading more, so the buffer only holds one request
+    buffer.erase(0, position);
+    position = 0;
+
+    char chunk[1 << 16];
+    ssize_t count;
+    do
+        count = recv(socket, chunk, sizeof(chunk), 0);
+    while (count < 0 && errno == EINTR);
+    if (count <= 0)
+        return false;
+
+    buffer.append(chunk, count);
+    return true;
+}
+
+bool ServerConnection::readLine(string &line)
+{
+    size_t end;
+    while ((end = buffer.find('\n', position)) == string::npos)
+        if (buffer.size() - position > SERVER_MAX_PROGRAM || !receive())
+            return false;
+
+    line.assign(buffer, position, end - position);
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    position = end + 1;
+    return true;
+}
+
+bool ServerConnection::readBytes(size_t count, string &bytes)
+{
+    while (buffer.size() - position < count)
+        if (!receive())
+            return false;
+
+    bytes.assign(buffer, position, count);
+    position += count;
+    return true;
+}
+
+void ServerConnection::send(const string &reply)
+{
+    lock_guard<mutex> guard(writeLock);
+
+    // A client that went away only loses its replies
+    size_t sent = 0;
+    while (sent < reply.size())
+    {
+        ssize_t count = ::send(socket, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return;
+        sent += count;
+    }
+}
+
+// Request for the session host, posted by the connection threads
+struct SessionRequest
+{
+    enum Kind
+    {
+        START, // Begin a session of program
+        FEED,  // Give session more input
+        DROP   // Remove every session of a connection that went away
+    } kind;
+    shared_ptr<ServerConnection> connection;
+    string id;
+    shared_ptr<const ServerProgram> program;
+    uint64_t session = 0;
+    vector<int> values;
+};
+
+// Thread that runs every session, whatever the machine model of the server is
+class SessionHost
+{
+public:
+    virtual ~SessionHost() = default;
+
+    // Method to queue a request for the host thread
+    virtual void post(SessionRequest request) = 0;
+};
+
+// Session host of one machine model, its scheduler is only ever touched by its own thread
+template <class Config>
+class BasicSessionHost : public SessionHost
+{
+private:
+    // Connection a session replies to, and the id of the START that began it
+    struct Session
+    {
+        shared_ptr<ServerConnection> connection;
+        string id;
+    };
+
+    mutex lock;
+    condition_variable wake;
+    deque<SessionRequest> inbox; // Requests not handled yet, guarded by lock
+    bool stopping = false;
+    Scheduler<Config> scheduler;
+    unordered_map<uint64_t, Session> sessions;
+    thread worker;
+
+    // Method to apply one request to the scheduler
+    void handle(SessionRequest &request);
+
+    // Method to tell the client of a session that it halted or waits for input
+    void report(uint64_t session);
+
+    // Method to take requests and run slices until the host is destroyed
+    void loop();
+
+public:
+    explicit BasicSessionHost(int quantum) : scheduler(quantum), worker(&BasicSessionHost::loop, this) {}
+    ~BasicSessionHost() override;
+
+    void post(SessionRequest request) override;
+};
+
+template <class Config>
+BasicSessionHost<Config>::~BasicSessionHost()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+template <class Config>
+void BasicSessionHost<Config>::post(SessionRequest request)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        inbox.push_back(move(request));
+    }
+    wake.notify_one();
+}
+
+template <class Config>
+void BasicSessionHost<Config>::handle(SessionRequest &request)
+{
+    if (request.kind == SessionRequest::START)
+    {
+        // The guest shares the cached program, which lives as long as any session runs it
+        shared_ptr<const Program> program(request.program, &request.program->program);
+        uint64_t session = scheduler.spawn(move(program), request.values);
+        sessions[session] = {request.connection, request.id};
+        request.connection->send("OK " + request.id + " " + to_string(session) + "\n");
+    }
+    else if (request.kind == SessionRequest::FEED)
+    {
+        // A connection only reaches its own sessions
+        auto found = sessions.find(request.session);
+        if (found == sessions.end() || found->second.connection != request.connection)
+            request.connection->send("ERROR " + request.id + " unknown session\n");
+        else
+            scheduler.feed(request.session, request.values);
+    }
+    else
+    {
+        for (auto session = sessions.begin(); session != sessions.end();)
+            if (session->second.connection == request.connection)
+            {
+                scheduler.remove(session->first);
+                session = sessions.erase(session);
+            }
+            else
+                ++session;
+    }
+}
+
+template <class Config>
+void BasicSessionHost<Config>::report(uint64_t session)
+{
+    Guest<Config> *guest = scheduler.find(session);
+    const Session &owner = sessions.at(session);
+
+    if (guest->state == GUEST_WAITING)
+    {
+        owner.connection->send("INPUT " + owner.id + " " + to_string(session) + "\n");
+        return;
+    }
+
+    // Same result text as RUN, then the session is gone
+    mapProgramCounter(guest->machine, *guest->program);
+    ostringstream result;
+    guest->output.print(result);
+    printState(result, guest->machine);
+    string text = result.str();
+    owner.connection->send("RESULT " + owner.id + " " + to_string(text.size()) + "\n" + text);
+
+    scheduler.remove(session);
+    sessions.erase(session);
+}
+
+template <class Config>
+void BasicSessionHost<Config>::loop()
+{
+    deque<SessionRequest> requests;
+    vector<uint64_t> changed;
+
+    while (true)
+    {
+        // Requests are taken between slices, so the lock is never held while guests run
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [this]
+                      { return stopping || !inbox.empty() || !scheduler.idle(); });
+            if (stopping)
+                return;
+            requests.swap(inbox);
+        }
+
+        for (SessionRequest &request : requests)
+            handle(request);
+        requests.clear();
+
+        scheduler.runSlice(changed);
+        for (uint64_t session : changed)
+            report(session);
+        changed.clear();
+    }
+}
+
+// Function to read the requests of one client until it disconnects
+// Runs are queued on the pool, each on a fresh machine, and reply as soon as they finish, sessions go to the host
+void serveConnection(shared_ptr<ServerConnection> connection, ThreadPool &pool, ProgramCache &cache, SessionHost &host, const RunOptions &options)
+{
+    string line;
+    while (connection->readLine(line))
+    {
+        istringstream header(line);
+        string command, id;
+        header >> command >> id;
+        if (id.empty())
+            id = "-";
+
+        auto fail = [&](const string &message)
+        { connection->send("ERROR " + id + " " + message + "\n"); };
+
+        shared_ptr<const ServerProgram> program;
+        uint64_t session = 0;
+        if (command == "SUBMIT" || command == "EXEC")
+        {
+            // A bad length leaves no way to find the next request, so the connection ends
+            size_t length;
+            if (!(header >> length) || length > SERVER_MAX_PROGRAM)
+            {
+                fail("bad program length");
+                return;
+            }
+            string text;
+            if (!connection->readBytes(length, text))
+                return;
+
+            uint64_t handle;
+            string error;
+            program = cache.add(move(text), options, handle, error);
+            if (!program)
+            {
+                fail(error);
+                continue;
+            }
+            if (command == "SUBMIT")
+            {
+                ostringstream reply;
+                reply << "OK " << id << " " << hex << setw(16) << setfill('0') << handle << "\n";
+                connection->send(reply.str());
+                continue;
+            }
+        }
+        else if (command == "RUN" || command == "START")
+        {
+            string handleText;
+            uint64_t handle = 0;
+            header >> handleText;
+            auto parsed = from_chars(handleText.data(), handleText.data() + handleText.size(), handle, 16);
+            if (handleText.empty() || parsed.ec != errc() || !(program = cache.find(handle)))
+            {
+                fail("unknown program");
+                continue;
+            }
+        }
+        else if (command == "FEED")
+        {
+            if (!(header >> session))
+            {
+                fail("unknown session");
+                continue;
+            }
+        }
+        else
+        {
+            fail("unknown command");
+            continue;
+        }
+
+        // The rest of the line holds the values for IN
+        string rest;
+        getline(header, rest);
+        vector<int> values;
+        if (!parseInputValues(rest, values))
+        {
+            fail("bad input values");
+            continue;
+        }
+
+        if (command == "START" || command == "FEED")
+        {
+            host.post({command == "START" ? SessionRequest::START : SessionRequest::FEED, connection, id, program, session, move(values)});
+            continue;
+        }
+
+        pool.submit([connection, program, id, values = move(values), &options]
+                    {
+                        string result = runWithBuffers(program->program, values, options, program->native.get());
+                        connection->send("RESULT " + id + " " + to_string(result.size()) + "\n" + result);
+                    });
+    }
+}
+
+// Function to serve runs on a Unix domain socket until the process is stopped
+int runServer(const string &socketPath, size_t threadCount, const RunOptions &options)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        cerr << "Error: Socket path is too long." << endl;
+        return 1;
+    }
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    // A socket left behind by an earlier server is replaced, any other file is not
+    struct stat existing;
+    if (stat(socketPath.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+        unlink(socketPath.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        cerr << "Error: Unable to listen on " << socketPath << endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    ThreadPool pool(threadCount);
+    ProgramCache cache;
+    unique_ptr<SessionHost> host = withMachineConfig(options.machine, [&options](auto config) -> unique_ptr<SessionHost>
+                                                     { return make_unique<BasicSessionHost<decltype(config)>>(options.quantum); });
+    cerr << "Server: listening on " << socketPath << endl;
+
+    while (true)
+    {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            // Connection threads still use the pool, the cache and the host, so they are never torn down
+            cerr << "Error: Unable to accept connections." << endl;
+            exit(1);
+        }
+
+        // The connection lives until its reader, every queued run and its sessions are done with it
+        auto connection = make_shared<ServerConnection>(client);
+        thread([connection, &pool, &cache, &host, &options]
+               {
+                   serveConnection(connection, pool, cache, *host, options);
+                   host->post({SessionRequest::DROP, connection, "", nullptr, 0, {}});
+               })
+            .detach();
+    }
+}
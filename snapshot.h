@@ -0,0 +1,257 @@
+#pragma once
+#include "objectfile.h"
+#include <algorithm>
+
+// Snapshot files hold raw machine words, so the layout must stay plain
+static_assert(is_trivially_copyable<Machine>::value, "machines are written to disk as bytes");
+
+// Version of the snapshot format, bump whenever the header or the layout changes
+const uint32_t SNAPSHOT_VERSION = 2;
+
+// Cells per page of a snapshot file, pages that are all zero are not stored
+const int SNAPSHOT_PAGE = 256;
+
+// Header at the start of every snapshot file
+// After it come the registers, a bitmap of the stored memory pages and the stored pages, all raw words
+struct SnapshotHeader
+{
+    char magic[4];        // "ASMS"
+    uint32_t version;     // SNAPSHOT_VERSION
+    uint64_t programHash; // Hash of the decoded program the machine was running
+    uint32_t wordBits;    // Shape of the machine
+    uint32_t registers;
+    uint32_t memory;
+    int32_t pc;
+    uint32_t flags;
+    uint32_t reserved; // Zero, keeps the counter on an 8-byte boundary
+    int64_t counter;
+};
+
+static_assert(sizeof(SnapshotHeader) == 48, "the snapshot header has no hidden padding");
+
+// Function to hash a decoded program field by field, so padding inside instructions never counts
+// Optimized code hashes differently from its source, a snapshot only resumes the exact code it was taken from
+uint64_t hashProgram(const Program &program)
+{
+    string bytes;
+    bytes.reserve(program.code.size() * 6 * sizeof(int32_t));
+    for (const Instruction &instruction : program.code)
+    {
+        int32_t fields[6] = {instruction.opcode, instruction.srcMode, instruction.dstMode,
+                             instruction.aux, instruction.src, instruction.dst};
+        bytes.append((const char *)fields, sizeof(fields));
+    }
+    return hashSource(bytes);
+}
+
+// Function to write the state of a machine between two instructions as a snapshot file
+template <class Config>
+bool writeSnapshot(const string &path, const BasicMachine<Config> &machine, const Program &program)
+{
+    using Word = typename Config::Word;
+    SnapshotHeader header = {{'A', 'S', 'M', 'S'}, SNAPSHOT_VERSION, hashProgram(program),
+                             Config::WORD_BITS, Config::REGISTERS, Config::MEMORY,
+                             machine.pc, machine.flags, 0, machine.counter};
+
+    // Most of a large memory is never touched, one bit per page tells which pages follow
+    const int pages = (Config::MEMORY + SNAPSHOT_PAGE - 1) / SNAPSHOT_PAGE;
+    vector<uint8_t> stored((pages + 7) / 8);
+    for (int page = 0; page < pages; page++)
+    {
+        const Word *first = machine.memory + page * SNAPSHOT_PAGE;
+        const Word *last = machine.memory + min(Config::MEMORY, (page + 1) * SNAPSHOT_PAGE);
+        if (any_of(first, last, [](Word cell)
+                   { return cell != 0; }))
+            stored[page / 8] |= 1 << (page % 8);
+    }
+
+    // Write to a private name first so a checkpoint is never left half-written
+    string temporary = temporaryPath(path);
+    bool written;
+    {
+        ofstream output(temporary, ios::binary);
+        output.write((const char *)&header, sizeof(header));
+        output.write((const char *)machine.registers, sizeof(machine.registers));
+        output.write((const char *)stored.data(), stored.size());
+        for (int page = 0; page < pages; page++)
+            if (stored[page / 8] & (1 << (page % 8)))
+            {
+                int first = page * SNAPSHOT_PAGE;
+                int count = min(Config::MEMORY - first, SNAPSHOT_PAGE);
+                output.write((const char *)(machine.memory + first), count * sizeof(Word));
+            }
+        output.close();
+        written = output.good();
+    }
+
+    return replaceFile(temporary, path, written);
+}
+
+// Function to load a snapshot file into a machine, reporting why it does not fit the program or the machine
+// Only the machine state is restored, input and output stay with the run that resumes it
+template <class Config>
+bool readSnapshot(const string &path, const Program &program, BasicMachine<Config> &machine)
+{
+    using Word = typename Config::Word;
+    MappedFile file;
+    if (!file.open(path))
+    {
+        cerr << "Error: Unable to open snapshot file." << endl;
+        return false;
+    }
+
+    string_view bytes = file.text();
+    SnapshotHeader header;
+    if (bytes.size() < sizeof(header))
+    {
+        cerr << "Error: Snapshot file is damaged." << endl;
+        return false;
+    }
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (memcmp(header.magic, "ASMS", 4) != 0 || header.version != SNAPSHOT_VERSION)
+    {
+        cerr << "Error: Snapshot file is damaged." << endl;
+        return false;
+    }
+    if (header.wordBits != Config::WORD_BITS || header.registers != Config::REGISTERS || header.memory != Config::MEMORY)
+    {
+        cerr << "Error: Snapshot was taken on a different machine." << endl;
+        return false;
+    }
+    if (header.programHash != hashProgram(program))
+    {
+        cerr << "Error: Snapshot was taken from a different program." << endl;
+        return false;
+    }
+
+    const int pages = (Config::MEMORY + SNAPSHOT_PAGE - 1) / SNAPSHOT_PAGE;
+    const char *stored = bytes.data() + sizeof(header) + sizeof(machine.registers);
+    size_t expected = sizeof(header) + sizeof(machine.registers) + (pages + 7) / 8;
+    if (bytes.size() >= expected)
+        for (int page = 0; page < pages; page++)
+            if (stored[page / 8] & (1 << (page % 8)))
+                expected += min(Config::MEMORY - page * SNAPSHOT_PAGE, SNAPSHOT_PAGE) * sizeof(Word);
+    if (bytes.size() != expected || header.pc < 0 || header.pc > (int32_t)program.code.size() || header.counter < 0)
+    {
+        cerr << "Error: Snapshot file is damaged." << endl;
+        return false;
+    }
+
+    machine.pc = header.pc;
+    machine.counter = header.counter;
+    machine.flags = (uint8_t)header.flags;
+    memcpy(machine.registers, bytes.data() + sizeof(header), sizeof(machine.registers));
+
+    const char *cells = stored + (pages + 7) / 8;
+    for (int page = 0; page < pages; page++)
+    {
+        int first = page * SNAPSHOT_PAGE;
+        int count = min(Config::MEMORY - first, SNAPSHOT_PAGE);
+        if (stored[page / 8] & (1 << (page % 8)))
+        {
+            memcpy(machine.memory + first, cells, count * sizeof(Word));
+            cells += count * sizeof(Word);
+        }
+        else
+            fill(machine.memory + first, machine.memory + first + count, (Word)0);
+    }
+    return true;
+}
+
+// Machine state kept in memory, forked into any number of independent machines
+// A fork is one plain copy of the machine, which costs no more than mapping the state copy-on-write would
+class Snapshot
+{
+private:
+    shared_ptr<const void> machine; // BasicMachine of the Config the snapshot was taken on
+
+public:
+    template <class Config>
+    explicit Snapshot(const BasicMachine<Config> &machine) : machine(make_shared<const BasicMachine<Config>>(machine)) {}
+
+    // Method to start a new machine in the saved state, with no input or output attached
+    template <class Config>
+    unique_ptr<BasicMachine<Config>> fork() const;
+};
+
+template <class Config>
+unique_ptr<BasicMachine<Config>> Snapshot::fork() const
+{
+    auto forked = make_unique<BasicMachine<Config>>(*static_pointer_cast<const BasicMachine<Config>>(machine));
+    forked->input = nullptr;
+    forked->output = nullptr;
+    return forked;
+}
+
+// Function to run a program until it halts or has executed at least limit instructions
+template <class Config>
+void runUntil(BasicMachine<Config> &machine, const Program &program, int64_t limit)
+{
+    BasicOperations<Config> operations(machine);
+    int size = (int)program.code.size();
+    while (machine.pc < size && machine.counter < limit)
+        step(operations, machine, program);
+}
+
+// When a run writes its snapshot file, the file always holds the state the run stopped in
+class SnapshotSchedule
+{
+private:
+    string path;
+    int64_t stopAt;   // Instruction count to stop at, 0 to run to the end
+    int64_t interval; // Instructions between checkpoints, 0 for none
+    int64_t next = INT64_MAX;
+    bool failed = false;
+
+    // Method to find the next instruction count a run has to stop at
+    void advance(int64_t counter);
+
+public:
+    SnapshotSchedule(const string &path, int64_t stopAt, int64_t interval) : path(path), stopAt(stopAt), interval(interval) {}
+
+    // Method to plan the snapshot points of a run that starts at an instruction count
+    void start(int64_t counter) { advance(counter); }
+
+    // Instruction count the run may go to before the schedule has to be asked again
+    int64_t limit() const { return next; }
+
+    // Method to write a checkpoint when one is due, true when the run has to stop
+    template <class Config>
+    bool reached(const BasicMachine<Config> &machine, const Program &program);
+
+    // Method to write the state the run stopped in
+    template <class Config>
+    void save(const BasicMachine<Config> &machine, const Program &program);
+
+    bool good() const { return !failed; }
+};
+
+void SnapshotSchedule::advance(int64_t counter)
+{
+    // A run restored past its stop point stops before its first instruction
+    next = INT64_MAX;
+    if (stopAt > 0)
+        next = max(stopAt, counter);
+    if (interval > 0 && counter / interval < (INT64_MAX - 1) / interval)
+        next = min(next, (counter / interval + 1) * interval);
+}
+
+template <class Config>
+bool SnapshotSchedule::reached(const BasicMachine<Config> &machine, const Program &program)
+{
+    if (machine.counter < next)
+        return false;
+    if (stopAt > 0 && machine.counter >= stopAt)
+        return true;
+
+    save(machine, program);
+    advance(machine.counter);
+    return false;
+}
+
+template <class Config>
+void SnapshotSchedule::save(const BasicMachine<Config> &machine, const Program &program)
+{
+    if (!writeSnapshot(path, machine, program))
+        failed = true;
+}
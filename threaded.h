@@ -0,0 +1,172 @@
+#pragma once
+#include "function.h"
+#include "jit.h"
+
+// Execution engines that can be chosen at runtime
+enum Engine
+{
+    ENGINE_SWITCH,   // One switch dispatch per instruction in a loop
+    ENGINE_THREADED, // Direct-threaded code, each handler jumps straight to the next
+    ENGINE_JIT       // Native x86-64 code, interpreted when the program cannot be compiled
+};
+
+// Function to run a decoded program with direct-threaded dispatch
+template <class Config>
+void runThreaded(BasicMachine<Config> &machine, const Program &program)
+{
+#if defined(__GNUC__)
+    BasicOperations<Config> commands(machine);
+    const Instruction *code = program.code.data();
+    const Instruction *instruction;
+    int size = (int)program.code.size();
+    int pc = min(machine.pc, size);
+
+    // Handler of each opcode, in the order of the Opcode enum
+    static void *const handlers[] = {
+        &&op_mov, &&op_math, &&op_math, &&op_math, &&op_math, &&op_incdec, &&op_incdec,
+        &&op_shift, &&op_shift, &&op_shift, &&op_shift, &&op_in, &&op_out, &&op_store, &&op_load,
+        &&op_bitwise, &&op_bitwise, &&op_bitwise, &&op_bitwise, &&op_cmp,
+        &&op_jmp, &&op_jz, &&op_jnz, &&op_jc,
+        &&op_incn, &&op_incn, &&op_addm,
+        &&op_block, &&op_block, &&op_block, &&op_vector, &&op_vector, &&op_vector};
+    static_assert(sizeof(handlers) / sizeof(handlers[0]) == OPCODE_COUNT, "every opcode needs a handler");
+
+    // Translate the program into handler addresses, the slot past the end halts
+    vector<void *> thread(size + 1);
+    for (int i = 0; i < size; i++)
+        thread[i] = handlers[code[i].opcode];
+    thread[size] = &&halt;
+
+#define DISPATCH()                \
+    do                            \
+    {                             \
+        instruction = &code[pc];  \
+        goto *thread[pc++];       \
+    } while (0)
+#define NEXT()               \
+    do                       \
+    {                        \
+        machine.counter++;   \
+        DISPATCH();          \
+    } while (0)
+
+    DISPATCH();
+
+op_mov:
+    commands.mov(*instruction);
+    NEXT();
+op_math:
+    commands.performMathOperation(*instruction);
+    NEXT();
+op_incdec:
+    commands.incrementAndDecrement(*instruction);
+    NEXT();
+op_shift:
+    commands.rotateAndShift(*instruction);
+    NEXT();
+op_in:
+    commands.input(*instruction);
+    NEXT();
+op_out:
+    commands.output(*instruction);
+    NEXT();
+op_store:
+    commands.store(*instruction);
+    NEXT();
+op_load:
+    commands.load(*instruction);
+    NEXT();
+op_bitwise:
+    commands.bitwiseOperation(*instruction);
+    NEXT();
+op_cmp:
+    commands.compare(*instruction);
+    NEXT();
+op_incn:
+    commands.repeatIncrement(*instruction);
+    NEXT();
+op_addm:
+    commands.addToMemory(*instruction);
+    NEXT();
+op_block:
+    commands.blockMemory(*instruction);
+    NEXT();
+op_vector:
+    commands.vectorOperation(*instruction);
+    NEXT();
+
+    // Jumps only move the local program counter, targets are already indices
+op_jmp:
+    pc = instruction->dst;
+    NEXT();
+op_jz:
+    if (machine.flags & FLAG_ZF)
+        pc = instruction->dst;
+    NEXT();
+op_jnz:
+    if (!(machine.flags & FLAG_ZF))
+        pc = instruction->dst;
+    NEXT();
+op_jc:
+    if (machine.flags & FLAG_CF)
+        pc = instruction->dst;
+    NEXT();
+
+halt:
+    machine.pc = size;
+
+#undef NEXT
+#undef DISPATCH
+#else
+    // Without computed goto the switch engine is the fallback
+    runProgram(machine, program);
+#endif
+}
+
+// Function to run a decoded program with the chosen engine
+// A program that runs many times passes the native code compiled once for it, null when it has to be interpreted
+template <class Config>
+void runWithEngine(Engine engine, BasicMachine<Config> &machine, const Program &program, const JitProgram *native)
+{
+    if (engine == ENGINE_THREADED)
+        runThreaded(machine, program);
+    else if (engine == ENGINE_JIT)
+    {
+        // Native code is generated for the default machine only and always starts at the first instruction
+        bool compiled = false;
+        if constexpr (is_same_v<Config, DefaultConfig>)
+            if (native != nullptr && machine.pc == 0)
+            {
+                native->run(machine);
+                compiled = true;
+            }
+        if (!compiled)
+            runProgram(machine, program);
+    }
+    else
+        runProgram(machine, program);
+}
+
+// Function to run a decoded program once with the chosen engine, compiling it first for the JIT
+template <class Config>
+void runWithEngine(Engine engine, BasicMachine<Config> &machine, const Program &program)
+{
+    shared_ptr<const JitProgram> native;
+    if (engine == ENGINE_JIT && is_same_v<Config, DefaultConfig> && machine.pc == 0)
+        native = compileJit(program);
+    runWithEngine(engine, machine, program, native.get());
+}
+
+// Function to parse an engine name from the command line
+bool parseEngine(const string &name, Engine &engine)
+{
+    if (name == "switch")
+        engine = ENGINE_SWITCH;
+    else if (name == "threaded")
+        engine = ENGINE_THREADED;
+    else if (name == "jit")
+        engine = ENGINE_JIT;
+    else
+        return false;
+    return true;
+}
@@ -0,0 +1,721 @@
+#pragma once
+#include "profiler.h"
+#include "optimizer.h"
+#include "display.h"
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// A trace file starts with "ASMT", the version, the word width, the program text and the initial state.
+// After that come blocks of records, one record per executed instruction:
+//   varint  opcode << 3 | changes (TRACE_FLAGS, TRACE_REGISTERS, TRACE_MEMORY)
+//   varint  next PC, jumps only (every other instruction falls through)
+//   varint  zigzag value, OUT only
+//   byte    old flags XOR new flags, with TRACE_FLAGS
+//   varint  mask of changed registers and one value each, with TRACE_REGISTERS
+//   varint  count of changed cells and a varint address and value each, with TRACE_MEMORY
+// Register and cell values are single bytes on the 8-bit machine and varints on the wider ones
+const uint8_t TRACE_VERSION = 1;
+
+// Changes recorded next to the opcode
+const int TRACE_FLAGS = 1;
+const int TRACE_REGISTERS = 2;
+const int TRACE_MEMORY = 4;
+
+// Ways a block of records is stored
+const uint8_t TRACE_STORED = 0;
+const uint8_t TRACE_PACKED = 1;
+
+// Records are handed to the writer thread in blocks of about this size
+const size_t TRACE_BLOCK_SIZE = 1 << 16;
+
+// Full blocks allowed to wait for the writer before the interpreter waits too
+const size_t TRACE_QUEUE_LIMIT = 8;
+
+// Function to append an unsigned LEB128 varint
+inline void writeVarint(vector<uint8_t> &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+// Function to store an unsigned LEB128 varint at out, returning the end of it
+inline uint8_t *putVarint(uint8_t *out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+// Function to store a register or cell value at out, returning the end of it
+template <class Config>
+inline uint8_t *putWord(uint8_t *out, uint64_t value)
+{
+    if constexpr (Config::WORD_BITS == 8)
+    {
+        *out++ = (uint8_t)value;
+        return out;
+    }
+    return putVarint(out, value);
+}
+
+// Function to read an unsigned LEB128 varint, false if it runs past the end
+inline bool readVarint(const uint8_t *&current, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; current != end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *current++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// Functions to map signed values to small unsigned ones and back
+inline uint64_t zigzag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+inline int64_t unzigzag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+// Function to compress a block with a small LZ77 coder
+// The output is a list of varint literal counts and literals, each but the last followed by a varint match length - 4 and offset
+vector<uint8_t> packBlock(const vector<uint8_t> &block)
+{
+    const size_t minimumMatch = 4;
+    const int hashBits = 14;
+    vector<uint8_t> out;
+    vector<int32_t> lastSeen(1 << hashBits, -1);
+    const uint8_t *data = block.data();
+    size_t size = block.size();
+    size_t anchor = 0;
+    size_t position = 0;
+
+    out.reserve(size / 2);
+    while (position + minimumMatch <= size)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, data + position, sizeof(sequence));
+        uint32_t slot = (sequence * 2654435761u) >> (32 - hashBits);
+        int32_t candidate = lastSeen[slot];
+        lastSeen[slot] = (int32_t)position;
+
+        if (candidate < 0 || memcmp(data + candidate, data + position, minimumMatch) != 0)
+        {
+            position++;
+            continue;
+        }
+
+        // Matches may overlap the bytes they produce, which is how loops become runs
+        size_t length = minimumMatch;
+        while (position + length < size && data[candidate + length] == data[position + length])
+            length++;
+
+        writeVarint(out, position - anchor);
+        out.insert(out.end(), data + anchor, data + position);
+        writeVarint(out, length - minimumMatch);
+        writeVarint(out, position - candidate);
+        position += length;
+        anchor = position;
+    }
+
+    writeVarint(out, size - anchor);
+    out.insert(out.end(), data + anchor, data + size);
+    return out;
+}
+
+// Function to expand a block written by packBlock, false if it is damaged
+bool unpackBlock(const uint8_t *current, const uint8_t *end, vector<uint8_t> &block)
+{
+    while (true)
+    {
+        uint64_t literals, length, offset;
+        if (!readVarint(current, end, literals) || literals > (uint64_t)(end - current))
+            return false;
+        block.insert(block.end(), current, current + literals);
+        current += literals;
+        if (current == end)
+            return true;
+
+        if (!readVarint(current, end, length) || !readVarint(current, end, offset) ||
+            offset == 0 || offset > block.size())
+            return false;
+        size_t from = block.size() - offset;
+        for (uint64_t i = 0; i < length + 4; i++)
+            block.push_back(block[from + i]);
+    }
+}
+
+// Recorder that streams the changes of every executed instruction to a trace file
+// Records are encoded by the interpreter thread, compressed and written by a background thread
+class TraceWriter
+{
+private:
+    ofstream file;
+    bool compress = false;
+    bool failed = false;
+
+    vector<uint8_t> buffer;              // Records of the block being filled
+    deque<vector<uint8_t>> pending;      // Full blocks waiting for the writer thread
+    mutex lock;
+    condition_variable changed;
+    bool closing = false;
+    thread worker;
+
+    // State before the instruction being recorded
+    int pc = 0;
+    MemoryRange writeRange;       // Cells the instruction may write
+    uint64_t writeValue = 0;      // Value before it ran when that is a single cell
+    vector<uint64_t> writeValues; // Values before it ran of a block instruction's range
+    uint8_t flags = 0;
+    uint64_t registers[MAX_REGISTERS] = {};
+
+    // Main loop of the writer thread
+    void writerLoop();
+
+    // Method to hand the filled block to the writer thread
+    void flush();
+
+public:
+    TraceWriter() = default;
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+    ~TraceWriter() { close(); }
+
+    // Method to create the trace file, false if it cannot be written
+    bool open(const string &path, bool compressBlocks);
+
+    // Method to write the program and the machine's starting state and start the writer thread
+    template <class Config>
+    bool start(const BasicMachine<Config> &machine, const Program &program);
+
+    // Method to remember the state an instruction is about to change, called before each step
+    template <class Config>
+    void before(const BasicMachine<Config> &machine, const Program &program);
+
+    // Method to record what the instruction changed, called after each step
+    template <class Config>
+    void after(const BasicMachine<Config> &machine, const Program &program);
+
+    // Method to write the remaining records and stop the writer thread, false if anything failed
+    bool close();
+};
+
+bool TraceWriter::open(const string &path, bool compressBlocks)
+{
+    file.open(path, ios::binary | ios::trunc);
+    compress = compressBlocks;
+    return file.is_open();
+}
+
+template <class Config>
+bool TraceWriter::start(const BasicMachine<Config> &machine, const Program &program)
+{
+    // The program text travels with the trace, so rendering needs nothing else
+    vector<uint8_t> header = {'A', 'S', 'M', 'T', TRACE_VERSION, (uint8_t)Config::WORD_BITS};
+    writeVarint(header, program.code.size());
+    for (string_view text : program.source)
+    {
+        writeVarint(header, text.size());
+        header.insert(header.end(), text.begin(), text.end());
+    }
+    writeVarint(header, program.originalIndex.size());
+    for (int32_t index : program.originalIndex)
+        writeVarint(header, index);
+
+    // Starting state, registers and cells only when they are not zero
+    header.push_back(machine.flags);
+    writeVarint(header, machine.pc);
+    writeVarint(header, machine.counter);
+    vector<uint8_t> cells;
+    size_t count = 0;
+    for (int i = 0; i < Config::REGISTERS; i++)
+        if (machine.registers[i] != 0)
+        {
+            writeVarint(cells, i);
+            writeVarint(cells, machine.registers[i]);
+            count++;
+        }
+    writeVarint(header, count);
+    header.insert(header.end(), cells.begin(), cells.end());
+    cells.clear();
+    count = 0;
+    for (int i = 0; i < Config::MEMORY; i++)
+        if (machine.memory[i] != 0)
+        {
+            writeVarint(cells, i);
+            writeVarint(cells, machine.memory[i]);
+            count++;
+        }
+    writeVarint(header, count);
+    header.insert(header.end(), cells.begin(), cells.end());
+
+    if (!file.write((const char *)header.data(), header.size()))
+    {
+        failed = true;
+        return false;
+    }
+
+    buffer.reserve(TRACE_BLOCK_SIZE + 64);
+    worker = thread(&TraceWriter::writerLoop, this);
+    return true;
+}
+
+template <class Config>
+void TraceWriter::before(const BasicMachine<Config> &machine, const Program &program)
+{
+    pc = machine.pc;
+    flags = machine.flags;
+    for (int i = 0; i < Config::REGISTERS; i++)
+        registers[i] = machine.registers[i];
+
+    // Only the cells the instruction writes can change, their addresses are known before it runs
+    writeRange = memoryWrite(program.code[pc], machine);
+    if (writeRange.count == 1)
+        writeValue = machine.memory[writeRange.address];
+    else
+        writeValues.assign(machine.memory + writeRange.address, machine.memory + writeRange.address + writeRange.count);
+}
+
+template <class Config>
+void TraceWriter::after(const BasicMachine<Config> &machine, const Program &program)
+{
+    const Instruction &instruction = program.code[pc];
+    int changes = 0;
+    uint64_t registerMask = 0;
+
+    if (machine.flags != flags)
+        changes |= TRACE_FLAGS;
+    for (int i = 0; i < Config::REGISTERS; i++)
+        registerMask |= (uint64_t)(machine.registers[i] != registers[i]) << i;
+    if (registerMask)
+        changes |= TRACE_REGISTERS;
+    const uint64_t *previous = writeRange.count == 1 ? &writeValue : writeValues.data();
+    uint32_t changedCells = 0;
+    for (uint32_t i = 0; i < writeRange.count; i++)
+        changedCells += machine.memory[writeRange.address + i] != previous[i];
+    if (changedCells)
+        changes |= TRACE_MEMORY;
+
+    // The fixed part of the record is built on the stack and appended in one go, it is at most a few dozen bytes
+    uint8_t record[16 + 10 * (MAX_REGISTERS + 4)];
+    uint8_t *out = putVarint(record, (uint64_t)instruction.opcode << 3 | changes);
+    if (instruction.opcode >= OP_JMP && instruction.opcode <= OP_JC)
+        out = putVarint(out, machine.pc);
+    if (instruction.opcode == OP_OUT)
+    {
+        // OUT changes nothing, its value is taken the way the interpreter takes it, the verifier proved the register exists
+        int64_t value = instruction.srcMode == MODE_REGISTER ? (int64_t)machine.registers[instruction.src] : instruction.src;
+        out = putVarint(out, zigzag(value));
+    }
+    if (changes & TRACE_FLAGS)
+        *out++ = machine.flags ^ flags;
+    if (changes & TRACE_REGISTERS)
+    {
+        out = putVarint(out, registerMask);
+        for (uint64_t mask = registerMask; mask; mask &= mask - 1)
+            out = putWord<Config>(out, machine.registers[__builtin_ctzll(mask)]);
+    }
+    if ((changes & TRACE_MEMORY) && writeRange.count == 1)
+    {
+        out = putVarint(out, 1);
+        out = putVarint(out, writeRange.address);
+        out = putWord<Config>(out, machine.memory[writeRange.address]);
+    }
+    buffer.insert(buffer.end(), record, out);
+
+    // A block instruction can change any number of cells, they follow the fixed part of the record
+    if ((changes & TRACE_MEMORY) && writeRange.count > 1)
+    {
+        writeVarint(buffer, changedCells);
+        for (uint32_t i = 0; i < writeRange.count; i++)
+        {
+            uint32_t address = writeRange.address + i;
+            if (machine.memory[address] == previous[i])
+                continue;
+            uint8_t cell[20];
+            uint8_t *end = putWord<Config>(putVarint(cell, address), machine.memory[address]);
+            buffer.insert(buffer.end(), cell, end);
+        }
+    }
+
+    if (buffer.size() >= TRACE_BLOCK_SIZE)
+        flush();
+}
+
+void TraceWriter::flush()
+{
+    // Nothing drains the queue when the writer thread never started, the records are dropped and the trace fails
+    if (!worker.joinable())
+    {
+        failed = failed || !buffer.empty();
+        buffer.clear();
+        return;
+    }
+    if (buffer.empty())
+        return;
+
+    vector<uint8_t> block;
+    block.reserve(TRACE_BLOCK_SIZE + 64);
+    block.swap(buffer);
+
+    // A slow disk holds the interpreter back instead of queueing the whole trace in memory
+    unique_lock<mutex> guard(lock);
+    changed.wait(guard, [this]
+                 { return pending.size() < TRACE_QUEUE_LIMIT; });
+    pending.push_back(move(block));
+    changed.notify_all();
+}
+
+void TraceWriter::writerLoop()
+{
+    while (true)
+    {
+        vector<uint8_t> block;
+        {
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [this]
+                         { return closing || !pending.empty(); });
+            if (pending.empty())
+                return;
+            block = move(pending.front());
+            pending.pop_front();
+        }
+        changed.notify_all();
+
+        // Blocks that do not shrink are stored as they are
+        vector<uint8_t> frame;
+        vector<uint8_t> packed;
+        if (compress)
+            packed = packBlock(block);
+        bool usePacked = compress && packed.size() < block.size();
+        const vector<uint8_t> &body = usePacked ? packed : block;
+
+        frame.push_back(usePacked ? TRACE_PACKED : TRACE_STORED);
+        writeVarint(frame, block.size());
+        writeVarint(frame, body.size());
+        if (!file.write((const char *)frame.data(), frame.size()) || !file.write((const char *)body.data(), body.size()))
+            failed = true;
+    }
+}
+
+bool TraceWriter::close()
+{
+    if (!worker.joinable())
+        return !failed;
+
+    flush();
+    {
+        lock_guard<mutex> guard(lock);
+        closing = true;
+    }
+    changed.notify_all();
+    worker.join();
+
+    file.close();
+    return !failed && !file.fail();
+}
+
+// Changes of one executed instruction, decoded from a trace
+struct TraceRecord
+{
+    int pc;     // Instruction that was executed
+    int nextPc; // Instruction executed after it
+    Opcode opcode;
+    int changes;
+    int64_t output;                       // Value written by OUT
+    uint8_t flagChanges;                  // Flags that toggled
+    uint64_t registerMask;                // Registers that changed
+    uint64_t registerValues[MAX_REGISTERS]; // New values of the changed registers
+    vector<pair<uint64_t, uint64_t>> cells; // Address and new value of the changed cells
+};
+
+// Reader that decodes a trace file record by record
+class TraceReader
+{
+private:
+    MappedFile file;
+    const uint8_t *current = nullptr;
+    const uint8_t *end = nullptr;
+
+    vector<uint8_t> block; // Records of the current block
+    size_t position = 0;
+    int pc = 0;
+
+    // Method to load the next block, false at the end of the file or on damage
+    bool nextBlock();
+
+    // Method to read a register or cell value of the trace's word width
+    bool readWord(const uint8_t *&data, const uint8_t *blockEnd, uint64_t &value) const;
+
+public:
+    int wordBits = 0;
+    vector<string> source;
+    Program program; // Source views into source and the PC map, no code
+    uint8_t flags = 0;
+    int startPc = 0;
+    int64_t startCounter = 0;
+    vector<pair<uint64_t, uint64_t>> registers; // Non-zero registers at the start
+    vector<pair<uint64_t, uint64_t>> memory;    // Non-zero cells at the start
+    bool damaged = false;
+
+    // Method to open a trace and read its header, false if it is not a trace
+    bool open(const string &path);
+
+    // Method to decode the next record, false after the last one
+    bool next(TraceRecord &record);
+};
+
+bool TraceReader::open(const string &path)
+{
+    if (!file.open(path))
+        return false;
+    string_view text = file.text();
+    current = (const uint8_t *)text.data();
+    end = current + text.size();
+
+    if (text.size() < 6 || text.substr(0, 4) != "ASMT" || current[4] != TRACE_VERSION)
+        return false;
+    wordBits = current[5];
+    current += 6;
+
+    uint64_t count, value, index;
+    if (!readVarint(current, end, count))
+        return false;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        if (!readVarint(current, end, value) || value > (uint64_t)(end - current))
+            return false;
+        source.emplace_back((const char *)current, value);
+        current += value;
+    }
+    for (const string &line : source)
+        program.source.push_back(line);
+
+    // An optimized program maps every instruction and its end, the program counter indexes the map
+    if (!readVarint(current, end, count) || (count != 0 && count != source.size() + 1))
+        return false;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        if (!readVarint(current, end, value))
+            return false;
+        program.originalIndex.push_back((int32_t)value);
+    }
+
+    if (current == end)
+        return false;
+    flags = *current++;
+    if (!readVarint(current, end, value) || value > source.size())
+        return false;
+    startPc = pc = (int)value;
+    if (!readVarint(current, end, value))
+        return false;
+    startCounter = (int64_t)value;
+
+    for (auto *cells : {&registers, &memory})
+    {
+        if (!readVarint(current, end, count))
+            return false;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (!readVarint(current, end, index) || !readVarint(current, end, value))
+                return false;
+            cells->emplace_back(index, value);
+        }
+    }
+    return true;
+}
+
+bool TraceReader::nextBlock()
+{
+    block.clear();
+    position = 0;
+    if (current == end)
+        return false;
+
+    uint8_t method = *current++;
+    uint64_t rawSize, size;
+    if (!readVarint(current, end, rawSize) || !readVarint(current, end, size) || size > (uint64_t)(end - current))
+    {
+        damaged = true;
+        return false;
+    }
+
+    if (method == TRACE_PACKED)
+        damaged = !unpackBlock(current, current + size, block) || block.size() != rawSize;
+    else if (method == TRACE_STORED)
+        block.assign(current, current + size);
+    else
+        damaged = true;
+    current += size;
+    return !damaged;
+}
+
+bool TraceReader::readWord(const uint8_t *&data, const uint8_t *blockEnd, uint64_t &value) const
+{
+    if (wordBits != 8)
+        return readVarint(data, blockEnd, value);
+    if (data == blockEnd)
+        return false;
+    value = *data++;
+    return true;
+}
+
+bool TraceReader::next(TraceRecord &record)
+{
+    if (position == block.size() && !nextBlock())
+        return false;
+
+    const uint8_t *data = block.data() + position;
+    const uint8_t *blockEnd = block.data() + block.size();
+    uint64_t value, count, address;
+
+    // Records never span blocks, so a short one means the file is damaged
+    auto fail = [this]
+    {
+        damaged = true;
+        return false;
+    };
+
+    if (!readVarint(data, blockEnd, value) || (value >> 3) >= OPCODE_COUNT || pc < 0 || pc >= (int)source.size())
+        return fail();
+    record.pc = pc;
+    record.opcode = (Opcode)(value >> 3);
+    record.changes = (int)(value & 7);
+    record.nextPc = pc + 1;
+    record.registerMask = 0;
+    record.cells.clear();
+
+    if (record.opcode >= OP_JMP && record.opcode <= OP_JC)
+    {
+        if (!readVarint(data, blockEnd, value) || value > source.size())
+            return fail();
+        record.nextPc = (int)value;
+    }
+    if (record.opcode == OP_OUT)
+    {
+        if (!readVarint(data, blockEnd, value))
+            return fail();
+        record.output = unzigzag(value);
+    }
+    if (record.changes & TRACE_FLAGS)
+    {
+        if (data == blockEnd)
+            return fail();
+        record.flagChanges = *data++;
+    }
+    if (record.changes & TRACE_REGISTERS)
+    {
+        if (!readVarint(data, blockEnd, record.registerMask) || record.registerMask >> MAX_REGISTERS)
+            return fail();
+        for (int i = 0; i < MAX_REGISTERS; i++)
+            if ((record.registerMask & (1ULL << i)) && !readWord(data, blockEnd, record.registerValues[i]))
+                return fail();
+    }
+    if (record.changes & TRACE_MEMORY)
+    {
+        if (!readVarint(data, blockEnd, count))
+            return fail();
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (!readVarint(data, blockEnd, address) || !readWord(data, blockEnd, value))
+                return fail();
+            record.cells.emplace_back(address, value);
+        }
+    }
+
+    position = data - block.data();
+    pc = record.nextPc;
+    return true;
+}
+
+// Function to replay a trace on a machine, showing every step the way an interactive run does unless headless
+// The final state is written like a normal run, false if the trace does not fit the machine or is damaged
+template <class Config>
+bool renderTrace(TraceReader &reader, bool headless, const DisplayOptions &displayOptions, const string &outputPath)
+{
+    auto owner = make_unique<BasicMachine<Config>>();
+    BasicMachine<Config> &machine = *owner;
+    OutputBuffer captured;
+    StateDisplay<Config> display(headless ? DisplayOptions() : displayOptions);
+
+    auto setRegister = [&machine](uint64_t index, uint64_t value)
+    {
+        if (index >= (uint64_t)Config::REGISTERS)
+            return false;
+        machine.registers[index] = (typename Config::Word)value;
+        return true;
+    };
+    auto setCell = [&machine](uint64_t address, uint64_t value)
+    {
+        if (address >= (uint64_t)Config::MEMORY)
+            return false;
+        machine.memory[address] = (typename Config::Word)value;
+        return true;
+    };
+
+    machine.flags = reader.flags;
+    machine.pc = reader.startPc;
+    machine.counter = reader.startCounter;
+    for (auto [index, value] : reader.registers)
+        if (!setRegister(index, value))
+            return false;
+    for (auto [address, value] : reader.memory)
+        if (!setCell(address, value))
+            return false;
+
+    TraceRecord record;
+    while (reader.next(record))
+    {
+        if (!headless)
+        {
+            cout << reader.source[record.pc] << endl;
+            if (!display.pause(machine))
+                break;
+        }
+
+        if (record.opcode == OP_OUT)
+        {
+            if (headless)
+                captured.write(record.output);
+            else
+                cout << "Output screen: " << record.output << endl;
+        }
+        if (record.changes & TRACE_FLAGS)
+            machine.flags ^= record.flagChanges;
+        for (int i = 0; i < MAX_REGISTERS; i++)
+            if ((record.registerMask & (1ULL << i)) && !setRegister(i, record.registerValues[i]))
+                return false;
+        for (auto [address, value] : record.cells)
+            if (!setCell(address, value))
+                return false;
+        machine.pc = record.nextPc;
+        machine.counter++;
+
+        if (!headless)
+            display.show(machine);
+    }
+    if (reader.damaged)
+        return false;
+
+    ostringstream screen;
+    captured.print(screen);
+    cout << screen.str();
+
+    mapProgramCounter(machine, reader.program);
+
+    ostringstream state;
+    printState(state, machine);
+    ofstream output(outputPath);
+    output << state.str();
+    return true;
+}
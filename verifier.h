@@ -0,0 +1,122 @@
+#pragma once
+#include "assembler.h"
+
+// Function to check that an operand has one of the allowed addressing modes
+inline bool hasMode(AddressMode mode, initializer_list<AddressMode> allowed)
+{
+    for (AddressMode candidate : allowed)
+        if (mode == candidate)
+            return true;
+    return false;
+}
+
+// Function to check that an instruction has the operand shapes its opcode relies on
+bool validShape(const Instruction &instruction)
+{
+    switch (instruction.opcode)
+    {
+    case OP_MOV:
+        return instruction.dstMode == MODE_REGISTER && hasMode(instruction.srcMode, {MODE_REGISTER, MODE_IMMEDIATE, MODE_INDIRECT});
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_CMP:
+        return instruction.dstMode == MODE_REGISTER && hasMode(instruction.srcMode, {MODE_REGISTER, MODE_IMMEDIATE});
+    case OP_INC:
+    case OP_DEC:
+    case OP_IN:
+    case OP_NOT:
+        return instruction.dstMode == MODE_REGISTER;
+    case OP_ROL:
+    case OP_ROR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_INCN:
+    case OP_DECN:
+        // Amounts and repeat counts are never negative
+        return instruction.dstMode == MODE_REGISTER && instruction.srcMode == MODE_IMMEDIATE && instruction.src >= 0;
+    case OP_OUT:
+        return hasMode(instruction.srcMode, {MODE_REGISTER, MODE_IMMEDIATE});
+    case OP_STORE:
+        return instruction.srcMode == MODE_REGISTER && hasMode(instruction.dstMode, {MODE_DIRECT, MODE_INDIRECT});
+    case OP_LOAD:
+        return instruction.dstMode == MODE_REGISTER && hasMode(instruction.srcMode, {MODE_DIRECT, MODE_INDIRECT});
+    case OP_JMP:
+    case OP_JZ:
+    case OP_JNZ:
+    case OP_JC:
+        return instruction.dstMode == MODE_TARGET;
+    case OP_ADDM:
+        return instruction.dstMode == MODE_DIRECT && hasMode(instruction.srcMode, {MODE_REGISTER, MODE_IMMEDIATE});
+    case OP_MEMSET:
+        return hasMode(instruction.srcMode, {MODE_REGISTER, MODE_IMMEDIATE}) && hasMode(instruction.dstMode, {MODE_DIRECT, MODE_INDIRECT});
+    case OP_MEMCPY:
+    case OP_MEMCMP:
+    case OP_VADD:
+    case OP_VXOR:
+        return hasMode(instruction.srcMode, {MODE_DIRECT, MODE_INDIRECT}) && hasMode(instruction.dstMode, {MODE_DIRECT, MODE_INDIRECT});
+    case OP_VSUM:
+        return hasMode(instruction.srcMode, {MODE_DIRECT, MODE_INDIRECT}) && instruction.dstMode == MODE_REGISTER;
+    }
+    return false;
+}
+
+// Function to check every instruction of a decoded program once, when it is loaded
+// Registers, direct addresses and jump targets that pass need no check on any execution path
+bool verifyProgram(const Program &program, int registerCount, int memorySize)
+{
+    // The assembler drops lines it rejects, everything after them would run shifted
+    if (program.errors > 0)
+    {
+        cerr << "Error: " << program.errors << " lines did not assemble" << endl;
+        return false;
+    }
+
+    int32_t size = (int32_t)program.code.size();
+    bool valid = true;
+
+    auto report = [&](size_t index, const char *message)
+    {
+        cerr << "Error: " << message << " on line " << program.lines[index] << endl;
+        valid = false;
+    };
+
+    for (size_t i = 0; i < program.code.size(); i++)
+    {
+        const Instruction &instruction = program.code[i];
+
+        // Objects come from disk, so even the opcode and the operand modes are checked
+        if (instruction.opcode >= OPCODE_COUNT || !validShape(instruction))
+        {
+            report(i, "Invalid operand");
+            continue;
+        }
+
+        for (auto [mode, value] : {pair<AddressMode, int32_t>(instruction.srcMode, instruction.src),
+                                   pair<AddressMode, int32_t>(instruction.dstMode, instruction.dst)})
+        {
+            if ((mode == MODE_REGISTER || mode == MODE_INDIRECT) && (value < 0 || value >= registerCount))
+                report(i, "Invalid register");
+            else if (mode == MODE_DIRECT && (value < 0 || value >= memorySize))
+                report(i, "Memory address out of range");
+            else if (mode == MODE_TARGET && (value < 0 || value > size))
+                report(i, "Jump target out of range");
+        }
+        // ADDM and the block instructions take one more register in aux
+        if ((instruction.opcode == OP_ADDM || instruction.opcode >= OP_MEMSET) && instruction.aux >= registerCount)
+            report(i, "Invalid register");
+    }
+
+    return valid;
+}
+
+// Function to verify a program against the registers and memory of a machine model
+bool verifyProgram(const Program &program, MachineModel model)
+{
+    return withMachineConfig(model, [&program](auto config)
+                             { return verifyProgram(program, decltype(config)::REGISTERS, decltype(config)::MEMORY); });
+}